@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+// Size-class allocator owned by a VM. Small blocks are carved out of 64 KiB
+// slabs and recycled through per-class free lists; anything bigger than the
+// largest class goes straight to malloc. Blocks freed by another thread (the
+// background sweeper) land on a separate locked list that the owning thread
+// adopts once its own free list runs dry.
+class Allocator {
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+    struct SizeClass {
+        FreeBlock *freeList{};
+        char *cursor{};
+        char *end{};
+        std::mutex remoteMutex;
+        FreeBlock *remoteList{};
+    };
+    static constexpr size_t slabSize = 64 * 1024;
+    static constexpr size_t granularity = 16;
+    static constexpr size_t sizeClasses[] = {
+            16, 32, 48, 64, 80, 96, 112, 128, 192, 256,
+            384, 512, 768, 1024, 1536, 2048, 3072, 4096};
+    static constexpr size_t numberOfClasses = sizeof(sizeClasses) / sizeof(size_t);
+    static constexpr size_t maxSize = sizeClasses[numberOfClasses - 1];
+
+    SizeClass classes[numberOfClasses];
+    unsigned char classIndex[maxSize / granularity + 1]{};
+    std::vector<void *> slabs;
+
+    void *refill(SizeClass &sizeClass, size_t blockSize);
+
+public:
+    Allocator();
+    Allocator(const Allocator &) = delete;
+    Allocator &operator=(const Allocator &) = delete;
+    ~Allocator();
+
+    static inline size_t blockSize(size_t size) {
+        if (size > maxSize) return size;
+        for (auto sizeClass: sizeClasses) {
+            if (size <= sizeClass) return sizeClass;
+        }
+        return size;
+    }
+    inline void *allocate(size_t size) {
+        if (size == 0) return nullptr;
+        if (size > maxSize) {
+            auto block = malloc(size);
+            if (block == nullptr)
+                throw std::runtime_error("Memory allocation failure!");
+            return block;
+        }
+        auto index = classIndex[(size + granularity - 1) / granularity];
+        auto &sizeClass = classes[index];
+        if (sizeClass.freeList != nullptr) {
+            auto block = sizeClass.freeList;
+            sizeClass.freeList = block->next;
+            return block;
+        }
+        return refill(sizeClass, sizeClasses[index]);
+    }
+    inline void deallocate(void *ptr, size_t size) {
+        if (ptr == nullptr) return;
+        if (size > maxSize) return free(ptr);
+        auto &sizeClass = classes[classIndex[(size + granularity - 1) / granularity]];
+        auto block = static_cast<FreeBlock *>(ptr);
+        block->next = sizeClass.freeList;
+        sizeClass.freeList = block;
+    }
+    void deallocateConcurrent(void *ptr, size_t size);
+    void *reallocate(void *ptr, size_t oldSize, size_t newSize);
+};
@@ -16,6 +16,7 @@ struct AbstractSyntaxTree {
         Declaration,
         ScopedBody,
         FunctionDeclaration,
+        StructDeclaration,
         ReturnStatement,
         TypeCast,
         FunctionCall,
@@ -24,7 +25,13 @@ struct AbstractSyntaxTree {
         ForLoop,
         List,
         ArrayType,
+        MapType,
+        MatrixType,
+        SoaType,
         ArrayAccess,
+        MatrixAccess,
+        FieldAccess,
+        ArraySlice,
         ImportStatement,
         ExportStatement,
         TernaryExpression,
@@ -112,6 +119,16 @@ struct FunctionDeclaration : public AbstractSyntaxTree {
     bool operator==(const AbstractSyntaxTree &other) const override;
 };
 
+struct StructDeclaration : public AbstractSyntaxTree {
+    std::vector<Declaration *> fields;
+    explicit StructDeclaration(const std::vector<Declaration *> &fields);
+    ~StructDeclaration() override {
+        for (auto &field : fields)
+            delete field;
+    }
+    bool operator==(const AbstractSyntaxTree &other) const override;
+};
+
 struct ReturnStatement : public AbstractSyntaxTree {
     AbstractSyntaxTree *expression;
     explicit ReturnStatement(AbstractSyntaxTree *expression);
@@ -131,6 +148,7 @@ struct TypeCast : public AbstractSyntaxTree {
         delete type;
     }
     bool operator==(const AbstractSyntaxTree &other) const override;
+    void compile(Program &program, Segment &segment) const override;
 };
 
 struct FunctionCall : public AbstractSyntaxTree {
@@ -197,6 +215,7 @@ struct List : public AbstractSyntaxTree {
     }
     bool operator==(const AbstractSyntaxTree &other) const override;
     void compile(Program &program, Segment &segment) const override;
+    void compileAs(Program &program, Segment &segment, VariableType *elementType) const;
 };
 
 struct ArrayType : public AbstractSyntaxTree {
@@ -208,6 +227,38 @@ struct ArrayType : public AbstractSyntaxTree {
     bool operator==(const AbstractSyntaxTree &other) const override;
 };
 
+struct MapType : public AbstractSyntaxTree {
+    AbstractSyntaxTree *keyType;
+    AbstractSyntaxTree *valueType;
+    MapType(AbstractSyntaxTree *keyType, AbstractSyntaxTree *valueType);
+    ~MapType() override {
+        delete keyType;
+        delete valueType;
+    }
+    bool operator==(const AbstractSyntaxTree &other) const override;
+};
+
+// float[,] names the type, float[rows, cols] also gives a declaration its shape
+struct MatrixType : public AbstractSyntaxTree {
+    AbstractSyntaxTree *type;
+    AbstractSyntaxTree *rows{};
+    AbstractSyntaxTree *cols{};
+    explicit MatrixType(AbstractSyntaxTree *type, AbstractSyntaxTree *rows = nullptr, AbstractSyntaxTree *cols = nullptr);
+    ~MatrixType() override {
+        delete type;
+        delete rows;
+        delete cols;
+    }
+    bool operator==(const AbstractSyntaxTree &other) const override;
+};
+
+// soa(Point) stores Point records as one column per field
+struct SoaType : public AbstractSyntaxTree {
+    Node record;
+    explicit SoaType(Node record);
+    bool operator==(const AbstractSyntaxTree &other) const override;
+};
+
 struct ArrayAccess : public AbstractSyntaxTree {
     Node identifier;
     AbstractSyntaxTree *index;
@@ -219,6 +270,43 @@ struct ArrayAccess : public AbstractSyntaxTree {
     void compile(Program &program, Segment &segment) const override;
 };
 
+struct MatrixAccess : public AbstractSyntaxTree {
+    Node identifier;
+    AbstractSyntaxTree *row;
+    AbstractSyntaxTree *col;
+    MatrixAccess(Node identifier, AbstractSyntaxTree *row, AbstractSyntaxTree *col);
+    ~MatrixAccess() override {
+        delete row;
+        delete col;
+    }
+    bool operator==(const AbstractSyntaxTree &other) const override;
+    void compile(Program &program, Segment &segment) const override;
+};
+
+struct FieldAccess : public AbstractSyntaxTree {
+    AbstractSyntaxTree *object;
+    Node field;
+    FieldAccess(AbstractSyntaxTree *object, Node field);
+    ~FieldAccess() override {
+        delete object;
+    }
+    bool operator==(const AbstractSyntaxTree &other) const override;
+    void compile(Program &program, Segment &segment) const override;
+};
+
+struct ArraySlice : public AbstractSyntaxTree {
+    Node identifier;
+    AbstractSyntaxTree *begin;
+    AbstractSyntaxTree *end;
+    ArraySlice(Node identifier, AbstractSyntaxTree *begin, AbstractSyntaxTree *end);
+    ~ArraySlice() override {
+        delete begin;
+        delete end;
+    }
+    bool operator==(const AbstractSyntaxTree &other) const override;
+    void compile(Program &program, Segment &segment) const override;
+};
+
 struct ImportStatement : public AbstractSyntaxTree {
     std::string path;
     explicit ImportStatement(std::string  path);
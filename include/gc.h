@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Allocator;
+struct Object;
+
+// Releases the resources held by obj and hands its memory back to where it
+// came from: pooled objects go to the VM's allocator, the rest to free().
+void destroyObject(Object *obj, Allocator &allocator, bool concurrent);
+
+// Frees unreachable objects on a helper thread. Objects handed over here are
+// already unlinked from every generation list, so neither the mutator nor a
+// later collection cycle can observe them again.
+class BackgroundSweeper {
+    Allocator &allocator;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::vector<Object *> pending;
+    bool stopping = false;
+
+    void loop();
+
+public:
+    explicit BackgroundSweeper(Allocator &allocator) : allocator(allocator){};
+    BackgroundSweeper(const BackgroundSweeper &) = delete;
+    BackgroundSweeper &operator=(const BackgroundSweeper &) = delete;
+    ~BackgroundSweeper();
+    void release(std::vector<Object *> &objects);
+};
+
+// Marks everything reachable from a set of roots within one generation.
+// Large root sets are split across worker threads, each with its own mark
+// stack; a worker whose stack runs dry steals half of another worker's.
+class ParallelMarker {
+    struct MarkStack {
+        std::mutex mutex;
+        std::vector<Object *> objects;
+    };
+    std::vector<std::unique_ptr<MarkStack>> stacks;
+    std::atomic<size_t> idleWorkers;
+    bool tenuredGeneration{};
+
+    [[nodiscard]] bool inGeneration(const Object *obj) const;
+    void markSequential(const std::vector<Object *> &roots);
+    void work(size_t id, Object *const *roots, size_t count);
+    bool pop(size_t id, Object *&obj);
+    bool steal(size_t id);
+    bool hasWork();
+
+public:
+    void mark(const std::vector<Object *> &roots, bool tenured, size_t threads, size_t parallelThreshold);
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Vectorized loops over array storage. Elements are passed as raw 64-bit
+// words, so the same buffers serve int[] and float[] arrays.
+uint64_t arraySumI64(const uint64_t *data, size_t size);
+double arraySumF64(const uint64_t *data, size_t size);
+int64_t arrayMinI64(const uint64_t *data, size_t size);
+double arrayMinF64(const uint64_t *data, size_t size);
+int64_t arrayMaxI64(const uint64_t *data, size_t size);
+double arrayMaxF64(const uint64_t *data, size_t size);
+uint64_t arrayDotI64(const uint64_t *left, const uint64_t *right, size_t size);
+double arrayDotF64(const uint64_t *left, const uint64_t *right, size_t size);
+void arrayScaleI64(uint64_t *data, size_t size, uint64_t factor);
+void arrayScaleF64(uint64_t *data, size_t size, double factor);
+void arrayAddI64(uint64_t *destination, const uint64_t *source, size_t size);
+void arrayAddF64(uint64_t *destination, const uint64_t *source, size_t size);
+void arrayFill(uint64_t *data, size_t size, uint64_t value);
+size_t arrayCountEqualI64(const uint64_t *data, size_t size, uint64_t value);
+size_t arrayCountEqualF64(const uint64_t *data, size_t size, double value);
+
+// Row-major matrices. The product of a rows x inner and an inner x cols
+// matrix is accumulated into result, which must be zeroed and distinct from
+// both operands.
+void matrixMultiplyI64(uint64_t *result, const uint64_t *left, const uint64_t *right,
+                       size_t rows, size_t inner, size_t cols);
+void matrixMultiplyF64(uint64_t *result, const uint64_t *left, const uint64_t *right,
+                       size_t rows, size_t inner, size_t cols);
+void matrixTranspose(uint64_t *destination, const uint64_t *source, size_t rows, size_t cols);
+
+// Bit packing of blocks of packedBlockValues integers, each below 2^width.
+// A block takes packedBlockValues * width / 64 words interleaved across
+// packedLanes lanes: value j is field j / packedLanes of lane j % packedLanes,
+// and word k of a lane is word k * packedLanes + lane of the block. Unpacking
+// adds base to every value.
+constexpr size_t packedBlockValues = 256;
+constexpr size_t packedLanes = 4;
+void packBlock(uint64_t *packed, const uint64_t *values, size_t width);
+void unpackBlock(uint64_t *destination, const uint64_t *packed, size_t width, uint64_t base);
+
+// Byte-string search over raw character buffers, which need not be
+// NUL-terminated. Positions are byte offsets.
+constexpr size_t stringNotFound = -1;
+size_t stringFind(const char *haystack, size_t length, const char *needle, size_t needleLength);
+// Non-overlapping occurrences
+size_t stringCount(const char *haystack, size_t length, const char *needle, size_t needleLength);
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// In-place sorts of array storage. Elements are mapped to unsigned keys with
+// the same order, so int[] and float[] share one LSD radix sort; floats are
+// ordered by their IEEE bits (-0.0 before 0.0, NaNs at the ends).
+//
+// Arrays of at least parallelThreshold elements are cut into one run per
+// thread, the runs are sorted concurrently and then merged pairwise, with
+// the merges of each round running in parallel. The unstable variants sort
+// runs with std::sort and need no scratch buffer below the threshold.
+void sortI64(uint64_t *data, size_t size, bool stable, size_t threads, size_t parallelThreshold);
+void sortF64(uint64_t *data, size_t size, bool stable, size_t threads, size_t parallelThreshold);
@@ -3,6 +3,7 @@
 #include "ast.h"
 #include "vm.h"
 #include <stdexcept>
+#include <unordered_set>
 
 #define GENERATE_EMIT_FUNCTION(OPERATION)                                                                   \
     static inline void emit##OPERATION(Program &program, Segment &segment, const std::string &identifier) { \
@@ -24,11 +25,17 @@
         switch (type->type) {                                                                               \
             case VariableType::Type::NativeLib:                                                             \
             case VariableType::Type::Array:                                                                 \
+            case VariableType::Type::Map:                                                                   \
+            case VariableType::Type::Matrix:                                                                \
+            case VariableType::Type::Struct:                                                                \
+            case VariableType::Type::Soa:                                                                   \
+            case VariableType::Type::CompressedArray:                                                       \
             case VariableType::Type::Object:                                                                \
                 instruction.type = isLocal ? Instruction::InstructionType::OPERATION##LocalObject           \
                                            : Instruction::InstructionType::OPERATION##GlobalObject;         \
                 instruction.params.index = id;                                                              \
                 break;                                                                                      \
+            case VariableType::Type::Bool:                                                                  \
             case VariableType::Type::I64:                                                                   \
                 instruction.type = isLocal ? Instruction::InstructionType::OPERATION##LocalI64              \
                                            : Instruction::InstructionType::OPERATION##GlobalI64;            \
@@ -75,14 +82,45 @@ enum class GenericInstruction {
     NotEqual
 };
 
+enum class ArrayInstruction {
+    MakeArray,
+    LoadFromLocalArray,
+    LoadFromGlobalArray,
+    StoreToLocalArray,
+    StoreToGlobalArray,
+    AppendToArray,
+};
+
+// Functions implemented by a single VM instruction. Overloads are picked by
+// the type of the first argument and, for arrays and maps, by its element or
+// key type. User-defined functions with the same name take precedence.
+struct Builtin {
+    Instruction::InstructionType instruction;
+    VariableType::Type returnType;
+    std::vector<VariableType::Type> arguments;
+    VariableType::Type elementType = VariableType::Invalid;
+    // Element type of the returned array or matrix
+    VariableType::Type returnElementType = VariableType::Invalid;
+};
+const Builtin *findBuiltin(Program &program, Segment &segment, const std::string &name,
+                           const std::vector<AbstractSyntaxTree *> &arguments);
+
 void assert(bool condition, const char *message);
-VariableType *varTypeConvert(AbstractSyntaxTree *ast);
+VariableType *varTypeConvert(Program &program, AbstractSyntaxTree *ast);
+const StructType::Field &findField(Program &program, Segment &segment, const FieldAccess &access);
 VariableType *deduceType(Program &program, Segment &segment, AbstractSyntaxTree *ast);
+VariableType::Type deduceElementType(Program &program, Segment &segment, AbstractSyntaxTree *ast);
 Instruction getInstructionWithType(GenericInstruction instruction, VariableType::Type type);
+Instruction::InstructionType getArrayInstruction(ArrayInstruction instruction, const VariableType *elementType);
 Instruction emitLoad(VariableType::Type, const Token &token);
 void typeCast(std::vector<Instruction> &instructions, VariableType::Type from, VariableType::Type to);
+// Also wraps values stored as fixed-width numbers
+void typeCast(std::vector<Instruction> &instructions, VariableType::Type from, const VariableType *to);
 VariableType::Type biggestType(VariableType::Type first, VariableType::Type second);
+// Operators on the bits of ints
+bool isBitwise(int op);
 VariableType::Type getInstructionType(const Program &program, const Instruction &instruction);
+void collectIdentifiers(const AbstractSyntaxTree *ast, std::unordered_set<std::string> &identifiers);
 
 #ifndef __cpp_lib_bit_cast
 namespace std {
@@ -1,12 +1,23 @@
 #pragma once
 
+#include "allocator.h"
+#include "gc.h"
 #include "spl.h"
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <deque>
 #include <dlfcn.h>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 
@@ -28,11 +39,43 @@
             Load##TYPE,           \
             LoadLocal##TYPE,      \
             LoadGlobal##TYPE
+#define ARRAY_TYPE_INSTRUCTION(TYPE)    \
+    MakeArray##TYPE,                    \
+            LoadFromLocalArray##TYPE,   \
+            LoadFromGlobalArray##TYPE,  \
+            StoreToLocalArray##TYPE,    \
+            StoreToGlobalArray##TYPE,   \
+            AppendToArray##TYPE
+#define ARRAY_KERNEL_INSTRUCTION(TYPE) \
+    ArraySum##TYPE,                    \
+            ArrayMin##TYPE,            \
+            ArrayMax##TYPE,            \
+            ArrayDot##TYPE,            \
+            ArrayScale##TYPE,          \
+            ArrayAdd##TYPE,            \
+            ArrayFill##TYPE,           \
+            ArrayCountEqual##TYPE,     \
+            ArraySort##TYPE,           \
+            ArraySortUnstable##TYPE
+#define MATRIX_KERNEL_INSTRUCTION(TYPE) \
+    MatrixAdd##TYPE,                    \
+            MatrixScale##TYPE,          \
+            MatrixSum##TYPE,            \
+            MatrixMultiply##TYPE
 struct Instruction {
     enum InstructionType : uint8_t {
         Invalid = 0,
         OP_TYPE_INSTRUCTION(I64),
         ModI64,
+        BitAndI64,
+        BitOrI64,
+        BitXorI64,
+        BitNotI64,
+        ShiftLeftI64,
+        ShiftRightI64,
+        // Shifts by a constant carry the amount in params.index
+        ShiftLeftConstI64,
+        ShiftRightConstI64,
         OP_TYPE_INSTRUCTION(F64),
         ConvertI64ToF64,
         ConvertF64ToI64,
@@ -41,16 +84,83 @@ struct Instruction {
         LoadObject,
         LoadGlobalObject,
         LoadLocalObject,
-        MakeArray,
-        LoadFromLocalArray,
-        LoadFromGlobalArray,
-        AppendToArray,
+        ARRAY_TYPE_INSTRUCTION(I64),
+        ARRAY_TYPE_INSTRUCTION(F64),
+        ARRAY_TYPE_INSTRUCTION(Bool),
+        ARRAY_TYPE_INSTRUCTION(Object),
+        ARRAY_TYPE_INSTRUCTION(Packed),
+        ARRAY_TYPE_INSTRUCTION(F32),
+        Narrow,
         Return,
         Call,
         JumpIfFalse,
+        JumpIfTrue,
+        // Compare two ints and jump to params.index when the comparison holds
+        JumpIfEqualI64,
+        JumpIfNotEqualI64,
+        JumpIfLessI64,
+        JumpIfLessEqualI64,
+        JumpIfGreaterI64,
+        JumpIfGreaterEqualI64,
         Jump,
         LoadLib,
         CallNative,
+        SliceArray,
+        ReserveArray,
+        ShrinkArray,
+        EqualString,
+        NotEqualString,
+        InternString,
+        ConcatString,
+        StringLength,
+        LoadStringChar,
+        AppendToLocalString,
+        AppendToGlobalString,
+        FreezeString,
+        MakeMap,
+        MapGet,
+        MapPut,
+        MapContains,
+        MapRemove,
+        MapSize,
+        ReserveMap,
+        ArrayLength,
+        StringFind,
+        StringContains,
+        StringCount,
+        StringStartsWith,
+        StringSplit,
+        MakeMatrix,
+        LoadMatrixElement,
+        StoreMatrixElement,
+        MatrixRows,
+        MatrixCols,
+        MatrixFill,
+        MatrixTranspose,
+        MakeStruct,
+        LoadField,
+        LoadObjectField,
+        StoreField,
+        StoreObjectField,
+        MakeSoa,
+        AppendToSoa,
+        AppendStructToSoa,
+        LoadSoaField,
+        LoadSoaObjectField,
+        StoreSoaField,
+        StoreSoaObjectField,
+        LoadSoaColumn,
+        LoadSoaRecord,
+        SoaLength,
+        CompressArray,
+        DecompressArray,
+        LoadCompressedElement,
+        CompressedLength,
+        CompressedSum,
+        ARRAY_KERNEL_INSTRUCTION(I64),
+        ARRAY_KERNEL_INSTRUCTION(F64),
+        MATRIX_KERNEL_INSTRUCTION(I64),
+        MATRIX_KERNEL_INSTRUCTION(F64),
         Exit
     } type{};
     union {
@@ -72,8 +182,18 @@ struct VariableType {
         Array,
         Function,
         NativeLib,
+        Map,
+        Matrix,
+        Struct,
+        Soa,
+        CompressedArray,
     } type;
+    // Fixed-width numbers, see NarrowType
+    bool narrow{};
     explicit VariableType(Type type) : type(type){};
+
+protected:
+    VariableType(Type type, bool narrow) : type(type), narrow(narrow){};
 };
 struct FunctionType : public VariableType {
     VariableType *returnType;
@@ -85,46 +205,292 @@ struct ArrayObjectType : public VariableType {
     VariableType *elementType;
     explicit ArrayObjectType(VariableType *elementType) : VariableType(Array), elementType(elementType){};
 };
+struct MapObjectType : public VariableType {
+    VariableType *keyType;
+    VariableType *valueType;
+    MapObjectType(VariableType *keyType, VariableType *valueType)
+        : VariableType(Map), keyType(keyType), valueType(valueType){};
+};
+struct MatrixObjectType : public VariableType {
+    VariableType *elementType;
+    explicit MatrixObjectType(VariableType *elementType) : VariableType(Matrix), elementType(elementType){};
+};
+// Fields live in 64-bit slots at offsets fixed at compile time. Object-typed
+// fields take the first slots, so the collector only scans a prefix.
+struct StructType : public VariableType {
+    struct Field {
+        std::string name;
+        VariableType *type;
+        size_t slot;
+    };
+    std::string name;
+    // In declaration order
+    std::vector<Field> fields;
+    size_t pointerFields{};
+    explicit StructType(std::string name) : VariableType(Struct), name(std::move(name)){};
+    [[nodiscard]] const Field *find_field(const std::string &field) const {
+        for (auto &candidate: fields) {
+            if (candidate.name == field)
+                return &candidate;
+        }
+        return nullptr;
+    }
+};
+struct SoaObjectType : public VariableType {
+    StructType *recordType;
+    explicit SoaObjectType(StructType *recordType) : VariableType(Soa), recordType(recordType){};
+};
 
+// Objects are a compact header followed by their payload in the same block.
+// They have no vtable: destroyObject() dispatches on objType instead.
 struct Object {
-    enum class Type {
+    enum class Type : uint32_t {
         Invalid = 0,
         String,
         Array,
         DynamicLib,
+        DynamicFunction,
+        Map,
+        Matrix,
+        Struct,
+        Soa,
+        CompressedArray,
     } objType;
-    Object() : objType(Type::Invalid){};
-    virtual ~Object() = default;
+    std::atomic<bool> marked = false;
+    bool tenured = false;
+    bool remembered = false;
+    // Allocated from the VM's Allocator rather than with malloc
+    bool pooled = false;
     explicit Object(Type type) : objType(type){};
-    bool marked = false;
+    [[nodiscard]] inline bool isMarked() const {
+        return marked.load(std::memory_order_relaxed);
+    }
+    inline void setMarked(bool value) {
+        marked.store(value, std::memory_order_relaxed);
+    }
+    inline bool tryMark() {
+        return !isMarked() && !marked.exchange(true, std::memory_order_relaxed);
+    }
 };
 struct StringObject : public Object {
     size_t length;
+    // Bytes available in the inline payload, excluding the terminator
+    size_t capacity;
     char *chars;
-    StringObject(size_t length, char *chars) : Object(Type::String), length(length), chars(chars){};
-    ~StringObject() override {
-        free(chars);
+    // FNV-1a of the contents, computed on first use; zero until then
+    uint64_t hash{};
+    // Canonical copy owned by Program::intern(), so interned strings are
+    // equal exactly when they are the same object
+    bool interned{};
+    // Owned by a single variable, so `s += piece` may append in place
+    bool builder{};
+    // Substrings produced by split() point into the characters of parent
+    // instead of holding a copy; they are not NUL-terminated
+    StringObject *parent{};
+    StringObject(size_t length, const char *source, size_t capacity = 0)
+        : Object(Type::String), length(length), capacity(std::max(length, capacity)),
+          chars(reinterpret_cast<char *>(this + 1)) {
+        std::memcpy(chars, source, length);
+        chars[length] = '\0';
+    };
+    StringObject(StringObject *parent, const char *chars, size_t length)
+        : Object(Type::String), length(length), capacity(0), chars(const_cast<char *>(chars)), parent(parent) {}
+    static constexpr size_t blockSize(size_t capacity) {
+        return sizeof(StringObject) + capacity + 1;
+    }
+    inline void append(const char *source, size_t count) {
+        std::memcpy(chars + length, source, count);
+        length += count;
+        chars[length] = '\0';
+        hash = 0;
+    }
+    static inline uint64_t hashOf(const char *chars, size_t length) {
+        uint64_t result = 0xcbf29ce484222325;
+        for (size_t i = 0; i < length; i++) {
+            result ^= (unsigned char) chars[i];
+            result *= 0x100000001b3;
+        }
+        return result == 0 ? 1 : result;
     }
-    inline bool operator==(StringObject &other) const {
+    inline uint64_t hashCode() {
+        if (hash == 0)
+            hash = hashOf(chars, length);
+        return hash;
+    }
+    inline bool operator==(StringObject &other) {
+        if (this == &other) return true;
+        if (interned && other.interned) return false;
         if (length != other.length) return false;
+        if (hash != 0 && other.hash != 0 && hash != other.hash) return false;
         return std::memcmp(chars, other.chars, length) == 0;
     }
     inline bool operator==(const char *other) const {
         if (strlen(other) != length) return false;
         return std::memcmp(chars, other, length) == 0;
     }
+    [[nodiscard]] inline std::string_view view() const {
+        return {chars, length};
+    }
 };
 struct ArrayObject : public Object {
+    // Storage picked from the declared element type: floats are kept as
+    // native doubles, bools are packed 64 to a word and str[] holds object
+    // pointers that the collector traces. Fixed-width numbers are packed at
+    // their own width.
+    enum class ElementType : uint8_t {
+        I64,
+        F64,
+        Bool,
+        Object,
+        I8,
+        I16,
+        I32,
+        U8,
+        U32,
+        F32,
+    } elementType;
+    // Points at the inline payload until the array outgrows it
     uint64_t *data;
     size_t size;
-    ArrayObject(size_t size, uint64_t *data) : Object(Object::Type::Array), size(size), data(data) {}
-    ~ArrayObject() override {
-        free(data);
+    size_t capacity;
+    size_t inlineCapacity;
+    // Slices are views into the storage of parent starting at offset, they
+    // own no elements until they are resized
+    ArrayObject *parent{};
+    size_t offset{};
+    explicit ArrayObject(size_t size, ElementType elementType = ElementType::I64)
+        : Object(Object::Type::Array), elementType(elementType), data(inlineData()), size(size),
+          capacity(roundCapacity(elementType, size)), inlineCapacity(capacity) {
+        if (elementType == ElementType::Bool || elementType == ElementType::Object)
+            std::memset(data, 0, storageBytes(elementType, capacity));
+    }
+    ArrayObject(ArrayObject *parent, size_t offset, size_t size)
+        : Object(Object::Type::Array), elementType(parent->elementType), data(nullptr), size(size),
+          capacity(size), inlineCapacity(0), parent(parent), offset(offset) {}
+    inline uint64_t *inlineData() {
+        return reinterpret_cast<uint64_t *>(this + 1);
+    }
+    [[nodiscard]] inline uint64_t *elements() const {
+        return parent == nullptr ? data : parent->data + offset;
+    }
+    [[nodiscard]] inline bool ownsExternalStorage() const {
+        return data != nullptr && data != reinterpret_cast<const uint64_t *>(this + 1);
+    }
+    // Bytes per element of the word aligned and fixed-width formats
+    static constexpr size_t elementBytes(ElementType type) {
+        switch (type) {
+            case ElementType::I8:
+            case ElementType::U8:
+                return 1;
+            case ElementType::I16:
+                return 2;
+            case ElementType::I32:
+            case ElementType::U32:
+            case ElementType::F32:
+                return 4;
+            default:
+                return sizeof(uint64_t);
+        }
+    }
+    // Whether elements are whole words that can be copied as raw storage
+    static constexpr bool wordAligned(ElementType type) {
+        return type == ElementType::I64 || type == ElementType::F64 || type == ElementType::Object;
+    }
+    // Capacities fill whole words
+    static constexpr size_t roundCapacity(ElementType type, size_t capacity) {
+        if (type == ElementType::Bool)
+            return (capacity + 63) / 64 * 64;
+        auto perWord = sizeof(uint64_t) / elementBytes(type);
+        return (capacity + perWord - 1) / perWord * perWord;
+    }
+    static constexpr size_t storageBytes(ElementType type, size_t capacity) {
+        if (type == ElementType::Bool)
+            return (capacity + 63) / 64 * sizeof(uint64_t);
+        return roundCapacity(type, capacity) * elementBytes(type);
+    }
+    static constexpr size_t blockSize(ElementType type, size_t capacity) {
+        return sizeof(ArrayObject) + storageBytes(type, capacity);
+    }
+    // Values of every format travel as I64 or F64: narrow integers are sign
+    // or zero extended and f32 is widened to a double. Views index into
+    // their parent, which is never a view itself.
+    [[nodiscard]] inline uint64_t get(size_t index) const {
+        if (parent != nullptr)
+            return parent->get(offset + index);
+        switch (elementType) {
+            case ElementType::Bool:
+                return (data[index / 64] >> (index % 64)) & 1;
+            case ElementType::I8:
+                return (int64_t) reinterpret_cast<const int8_t *>(data)[index];
+            case ElementType::I16:
+                return (int64_t) reinterpret_cast<const int16_t *>(data)[index];
+            case ElementType::I32:
+                return (int64_t) reinterpret_cast<const int32_t *>(data)[index];
+            case ElementType::U8:
+                return reinterpret_cast<const uint8_t *>(data)[index];
+            case ElementType::U32:
+                return reinterpret_cast<const uint32_t *>(data)[index];
+            case ElementType::F32:
+                return std::bit_cast<uint64_t>((double) reinterpret_cast<const float *>(data)[index]);
+            default:
+                return data[index];
+        }
+    }
+    // Narrow formats keep the low bits of integers and round doubles to float
+    inline void set(size_t index, uint64_t value) {
+        if (parent != nullptr)
+            return parent->set(offset + index, value);
+        switch (elementType) {
+            case ElementType::Bool: {
+                auto mask = uint64_t(1) << (index % 64);
+                data[index / 64] = (data[index / 64] & ~mask) | (value != 0 ? mask : 0);
+            } break;
+            case ElementType::I8:
+            case ElementType::U8:
+                reinterpret_cast<uint8_t *>(data)[index] = (uint8_t) value;
+                break;
+            case ElementType::I16:
+                reinterpret_cast<uint16_t *>(data)[index] = (uint16_t) value;
+                break;
+            case ElementType::I32:
+            case ElementType::U32:
+                reinterpret_cast<uint32_t *>(data)[index] = (uint32_t) value;
+                break;
+            case ElementType::F32:
+                reinterpret_cast<float *>(data)[index] = (float) std::bit_cast<double>(value);
+                break;
+            default:
+                data[index] = value;
+        }
+    }
+    // The value get() would return after storing value with set()
+    static constexpr uint64_t narrow(ElementType type, uint64_t value) {
+        switch (type) {
+            case ElementType::I8:
+                return (int64_t) (int8_t) value;
+            case ElementType::I16:
+                return (int64_t) (int16_t) value;
+            case ElementType::I32:
+                return (int64_t) (int32_t) value;
+            case ElementType::U8:
+                return (uint8_t) value;
+            case ElementType::U32:
+                return (uint32_t) value;
+            case ElementType::F32:
+                return std::bit_cast<uint64_t>((double) (float) std::bit_cast<double>(value));
+            default:
+                return value;
+        }
+    }
+    // MakeArrayPacked and MakeArrayF32 carry the element count and format in
+    // params.index
+    static constexpr size_t packShape(size_t size, ElementType type) {
+        return size << 8 | (size_t) type;
     }
     inline bool operator==(ArrayObject &other) const {
         if (size != other.size) return false;
         for (size_t i = 0; i < size; i++) {
-            if (data[i] != other.data[i])
+            if (get(i) != other.get(i))
                 return false;
         }
         return true;
@@ -132,29 +498,293 @@ struct ArrayObject : public Object {
     inline bool operator==(const std::vector<uint64_t> &other) const {
         if (size != other.size()) return false;
         for (size_t i = 0; i < size; i++) {
-            if (data[i] != other[i])
+            if (get(i) != other[i])
                 return false;
         }
         return true;
     }
 };
+// Fixed-width numbers compute as I64 or F64 like the wide types and are only
+// narrowed to their storage format when they are stored
+struct NarrowType : public VariableType {
+    ArrayObject::ElementType storage;
+    explicit NarrowType(ArrayObject::ElementType storage)
+        : VariableType(storage == ArrayObject::ElementType::F32 ? F64 : I64, true), storage(storage){};
+};
+// Storage format of values of a type inside arrays
+inline ArrayObject::ElementType storageOf(const VariableType *type) {
+    if (type->narrow)
+        return ((const NarrowType *) type)->storage;
+    switch (type->type) {
+        case VariableType::Bool:
+            return ArrayObject::ElementType::Bool;
+        case VariableType::F64:
+            return ArrayObject::ElementType::F64;
+        case VariableType::I64:
+            return ArrayObject::ElementType::I64;
+        default:
+            return ArrayObject::ElementType::Object;
+    }
+}
+// Open-addressing hash table in the SwissTable layout: one control byte per
+// slot holds either a marker or 7 bits of the key's hash, so lookups compare
+// a whole group of control bytes at once and only touch the keys whose hash
+// bits match. Control bytes, keys and values share one external block.
+struct MapObject : public Object {
+    static constexpr size_t groupWidth = 16;
+    static constexpr uint8_t empty = 0x80;
+    static constexpr uint8_t deleted = 0xFE;
+    static constexpr size_t npos = -1;
+    VariableType::Type keyType;
+    VariableType::Type valueType;
+    size_t size{};
+    // Number of slots, a power of two no smaller than groupWidth once the
+    // table is allocated
+    size_t capacity{};
+    // Empty slots that can still be filled before the table must grow
+    size_t growthLeft{};
+    // capacity + groupWidth bytes: the first group is mirrored at the end so
+    // a group can be loaded from any slot without wrapping
+    uint8_t *control{};
+    uint64_t *keys{};
+    uint64_t *values{};
+    MapObject(VariableType::Type keyType, VariableType::Type valueType)
+        : Object(Object::Type::Map), keyType(keyType), valueType(valueType) {}
+    // Map instructions carry both types in params.index so they know which
+    // operand stack every operand lives on
+    static constexpr size_t packTypes(VariableType::Type keyType, VariableType::Type valueType) {
+        return keyType | (size_t) valueType << 32;
+    }
+    static constexpr VariableType::Type keyTypeOf(size_t types) {
+        return (VariableType::Type) (types & 0xFFFFFFFF);
+    }
+    static constexpr VariableType::Type valueTypeOf(size_t types) {
+        return (VariableType::Type) (types >> 32);
+    }
+    static constexpr bool isObjectType(VariableType::Type type) {
+        return type == VariableType::Object || type == VariableType::Array ||
+               type == VariableType::Map || type == VariableType::Matrix ||
+               type == VariableType::Struct || type == VariableType::Soa ||
+               type == VariableType::CompressedArray || type == VariableType::NativeLib;
+    }
+    [[nodiscard]] inline bool stringKeys() const {
+        return keyType == VariableType::Object;
+    }
+    [[nodiscard]] inline bool objectValues() const {
+        return isObjectType(valueType);
+    }
+    static constexpr size_t storageBytes(size_t capacity) {
+        if (capacity == 0) return 0;
+        return capacity + groupWidth + 2 * capacity * sizeof(uint64_t);
+    }
+    // Largest power of two whose storage size fits in a size_t
+    static constexpr size_t maxCapacity = std::bit_floor((SIZE_MAX - groupWidth) / (1 + 2 * sizeof(uint64_t)));
+    // Smallest table that holds count entries under the 7/8 load factor
+    static constexpr size_t capacityFor(size_t count) {
+        size_t capacity = groupWidth;
+        while (capacity - capacity / 8 < count) {
+            if (capacity == maxCapacity)
+                throw std::runtime_error("[MapObject::capacityFor] Map is too large!");
+            capacity *= 2;
+        }
+        return capacity;
+    }
+    [[nodiscard]] uint64_t hashOf(uint64_t key) const;
+    [[nodiscard]] size_t find(uint64_t key) const;
+    // Slot for a key known to be absent, growthLeft must be non-zero
+    size_t insert(uint64_t key);
+    void erase(size_t slot);
+    // Moves every entry into storage sized for capacity slots and returns
+    // the previous block
+    void *rehash(void *storage, size_t capacity);
+};
+// Dense row-major matrix of int or float elements stored inline after the
+// header, so a whole matrix is one block and element (i, j) is one load
+struct MatrixObject : public Object {
+    VariableType::Type elementType;
+    size_t rows;
+    size_t cols;
+    MatrixObject(size_t rows, size_t cols, VariableType::Type elementType)
+        : Object(Object::Type::Matrix), elementType(elementType), rows(rows), cols(cols) {
+        std::memset(data(), 0, rows * cols * sizeof(uint64_t));
+    }
+    [[nodiscard]] inline uint64_t *data() const {
+        return reinterpret_cast<uint64_t *>(const_cast<MatrixObject *>(this) + 1);
+    }
+    [[nodiscard]] inline size_t size() const {
+        return rows * cols;
+    }
+    [[nodiscard]] inline uint64_t &at(size_t row, size_t col) const {
+        return data()[row * cols + col];
+    }
+    static constexpr size_t blockSize(size_t rows, size_t cols) {
+        return sizeof(MatrixObject) + rows * cols * sizeof(uint64_t);
+    }
+};
+struct StructObject : public Object {
+    const StructType *layout;
+    // Layouts belong to the Program, which may be gone by the time the
+    // collector frees the object
+    size_t fieldCount;
+    explicit StructObject(const StructType *layout)
+        : Object(Object::Type::Struct), layout(layout), fieldCount(layout->fields.size()) {
+        std::memset(fields(), 0, fieldCount * sizeof(uint64_t));
+    }
+    [[nodiscard]] inline uint64_t *fields() const {
+        return reinterpret_cast<uint64_t *>(const_cast<StructObject *>(this) + 1);
+    }
+    static constexpr size_t blockSize(size_t fieldCount) {
+        return sizeof(StructObject) + fieldCount * sizeof(uint64_t);
+    }
+    // Field instructions carry the slot and the field type in params.index
+    static constexpr size_t packField(size_t slot, VariableType::Type type) {
+        return slot | (size_t) type << 32;
+    }
+    static constexpr size_t slotOf(size_t field) {
+        return field & 0xFFFFFFFF;
+    }
+    static constexpr VariableType::Type typeOf(size_t field) {
+        return (VariableType::Type) (field >> 32);
+    }
+};
+// Records of one struct type stored as a column per field, indexed by the
+// field's slot. Columns are ordinary typed arrays that always hold size
+// elements, so a pass over one field streams through one array.
+struct SoaObject : public Object {
+    const StructType *layout;
+    size_t fieldCount;
+    size_t size{};
+    explicit SoaObject(const StructType *layout)
+        : Object(Object::Type::Soa), layout(layout), fieldCount(layout->fields.size()) {
+        std::memset(columns(), 0, fieldCount * sizeof(ArrayObject *));
+    }
+    [[nodiscard]] inline ArrayObject **columns() const {
+        return reinterpret_cast<ArrayObject **>(const_cast<SoaObject *>(this) + 1);
+    }
+    static constexpr size_t blockSize(size_t fieldCount) {
+        return sizeof(SoaObject) + fieldCount * sizeof(ArrayObject *);
+    }
+};
+// Immutable int array packed in blocks of blockValues elements. A block keeps
+// each element as an offset from its base in the fewest bits that hold every
+// offset: value - min, or for sorted blocks where it is narrower, the
+// difference from the previous element. Block headers and then the packed
+// words follow the header.
+struct CompressedArrayObject : public Object {
+    static constexpr size_t blockValues = 256;
+    struct Block {
+        uint64_t base;
+        // Index of the block's first packed word
+        size_t offset;
+        uint8_t width;
+        bool delta;
+    };
+    size_t size;
+    size_t blockCount;
+    size_t words;
+    CompressedArrayObject(const uint64_t *values, size_t size, const std::vector<Block> &plan);
+    [[nodiscard]] inline Block *blocks() const {
+        return reinterpret_cast<Block *>(const_cast<CompressedArrayObject *>(this) + 1);
+    }
+    [[nodiscard]] inline uint64_t *packed() const {
+        return reinterpret_cast<uint64_t *>(blocks() + blockCount);
+    }
+    static constexpr size_t packedWords(size_t width) {
+        return width * blockValues / 64;
+    }
+    static constexpr size_t blockSize(size_t blockCount, size_t words) {
+        return sizeof(CompressedArrayObject) + blockCount * sizeof(Block) + words * sizeof(uint64_t);
+    }
+    // Picks the encoding and packed offset of every block of values
+    static std::vector<Block> plan(const uint64_t *values, size_t size);
+    static size_t totalWords(const std::vector<Block> &plan) {
+        return plan.empty() ? 0 : plan.back().offset + packedWords(plan.back().width);
+    }
+    // Writes all blockValues elements of a block, including the padding
+    // after the last element
+    void decodeBlock(size_t block, uint64_t *destination) const;
+    void decode(uint64_t *destination) const;
+    // Packed field j of a block, without the base
+    [[nodiscard]] uint64_t field(const Block &block, size_t j) const;
+    [[nodiscard]] uint64_t get(size_t index) const;
+    [[nodiscard]] uint64_t sum() const;
+};
 struct DynamicLibObject : public Object {
     void *handle;
     char *dlPath;
     explicit DynamicLibObject(char *dlPath, void *handle)
         : Object(Object::Type::DynamicLib), dlPath(dlPath), handle(handle){};
-    ~DynamicLibObject() override {
-        dlclose(handle);
-    }
 };
 struct DynamicFunctionObject : public Object {
     std::string name;
     std::vector<VariableType *> arguments;
     explicit DynamicFunctionObject(std::string name, std::vector<VariableType *> arguments)
-        : name(std::move(name)), arguments(std::move(arguments)){};
-    ~DynamicFunctionObject() override = default;
+        : Object(Object::Type::DynamicFunction), name(std::move(name)), arguments(std::move(arguments)){};
 };
 
+// Constructs an object in a malloc'ed block, for objects that do not belong
+// to a VM heap such as literals and the results of native functions.
+template<typename T, typename... Args>
+T *makeObject(size_t blockSize, Args &&...args) {
+    auto block = malloc(blockSize);
+    if (block == nullptr)
+        throw std::runtime_error("Memory allocation failure!");
+    return new (block) T(std::forward<Args>(args)...);
+}
+
+// Calls visit(Object *) on every object directly referenced by obj. This is
+// the only place the garbage collector learns about object layouts.
+template<typename Visitor>
+inline void forEachReference(Object *obj, Visitor &&visit) {
+    switch (obj->objType) {
+        case Object::Type::Array: {
+            auto array = static_cast<ArrayObject *>(obj);
+            // Elements of a view are traced through its parent
+            if (array->parent != nullptr) {
+                visit(array->parent);
+            } else if (array->elementType == ArrayObject::ElementType::Object) {
+                for (size_t i = 0; i < array->size; i++) {
+                    if (array->data[i] != 0)
+                        visit(reinterpret_cast<Object *>(array->data[i]));
+                }
+            }
+        } break;
+        case Object::Type::String: {
+            auto string = static_cast<StringObject *>(obj);
+            if (string->parent != nullptr)
+                visit(string->parent);
+        } break;
+        case Object::Type::Map: {
+            auto map = static_cast<MapObject *>(obj);
+            auto stringKeys = map->stringKeys(), objectValues = map->objectValues();
+            if (!stringKeys && !objectValues) break;
+            for (size_t i = 0; i < map->capacity; i++) {
+                if (map->control[i] & 0x80) continue;
+                if (stringKeys)
+                    visit(reinterpret_cast<Object *>(map->keys[i]));
+                if (objectValues && map->values[i] != 0)
+                    visit(reinterpret_cast<Object *>(map->values[i]));
+            }
+        } break;
+        case Object::Type::Struct: {
+            auto object = static_cast<StructObject *>(obj);
+            for (size_t i = 0; i < object->layout->pointerFields; i++) {
+                if (object->fields()[i] != 0)
+                    visit(reinterpret_cast<Object *>(object->fields()[i]));
+            }
+        } break;
+        case Object::Type::Soa: {
+            auto soa = static_cast<SoaObject *>(obj);
+            for (size_t i = 0; i < soa->layout->fields.size(); i++) {
+                if (soa->columns()[i] != nullptr)
+                    visit(soa->columns()[i]);
+            }
+        } break;
+        default:
+            break;
+    }
+}
+
 struct Variable {
     std::string name;
     VariableType *type{};
@@ -164,6 +794,8 @@ struct Variable {
         : name(std::move(name)), type(type), index(index){};
 };
 
+struct AbstractSyntaxTree;
+
 struct Segment {
     std::vector<Instruction> instructions;
     std::unordered_map<std::string, Variable> locals;
@@ -175,15 +807,27 @@ struct Segment {
     size_t id{};
     size_t find_local(const std::string &identifier);
     VariableType *returnType{};
+    // Function body kept as AST until the first call reaches this segment
+    const AbstractSyntaxTree *body{};
     void declare_variable(const std::string &name, VariableType *varType);
     void declare_function(const std::string &name, VariableType *funcType, size_t index);
 };
 
 struct Program {
-    std::vector<Segment> segments;
+    std::deque<Segment> segments;
+    std::vector<std::shared_ptr<AbstractSyntaxTree>> trees;
+    // Identifiers referenced by the compilation unit, used to prune imports
+    std::unordered_set<std::string> references;
+    std::vector<const AbstractSyntaxTree *> pendingExports;
+    // Canonical string objects keyed by their contents. String literals are
+    // interned at compile time so identical literals share one object.
+    std::unordered_map<std::string_view, std::unique_ptr<StringObject, decltype(&free)>> strings;
+    std::unordered_map<std::string, std::unique_ptr<StructType>> structs;
     Program();
+    StringObject *intern(std::string_view value);
     size_t find_global(const std::string &identifier);
     Variable find_function(const Segment &segment, const std::string &identifier);
+    void compile_segment(size_t index);
 };
 
 struct StackFrame {
@@ -193,20 +837,58 @@ struct StackFrame {
     size_t localPointersSize{};
     size_t segmentIndex{};
     size_t currentInstruction{};
+    bool dirty{};
 };
 
 class VM {
-    const size_t gcLimit = 1024;
+    enum class GCPhase {
+        Idle,
+        Mark,
+        Sweep,
+    } gcPhase = GCPhase::Idle;
+    size_t nurseryBytes{};
+    size_t tenuredBytes{};
+    size_t liveBytes{};
+    size_t gcCountdown = 1;
+    size_t sweepRead{};
+    size_t sweepWrite{};
 
     uint64_t *stack;
     Object **pointersStack;
     size_t stackCapacity;
     size_t pointersStackCapacity;
     std::vector<StackFrame> callStack;
-    std::vector<Object *> objects;
+    std::vector<Object *> nursery;
+    std::vector<Object *> tenured;
+    std::vector<Object *> rememberedSet;
+    std::vector<Object *> grayStack;
+    std::vector<Object *> roots;
+    std::vector<Object *> deadObjects;
+    Allocator allocator;
+    BackgroundSweeper sweeper{allocator};
+    ParallelMarker marker;
 
+    ArrayObject *makeArray(size_t size, ArrayObject::ElementType elementType);
+    void resizeArray(ArrayObject *array, size_t capacity);
+    StringObject *concatStrings(StringObject *left, StringObject *right, size_t capacity);
+    void resizeMap(MapObject *map, size_t capacity);
+    void splitString(StringObject *string, StringObject *separator);
+    MatrixObject *makeMatrix(size_t rows, size_t cols, VariableType::Type elementType);
+    ArrayObject *sliceArray(ArrayObject *array, size_t begin, size_t end);
+    SoaObject *makeSoa(const StructType *layout);
+    CompressedArrayObject *compressArray(const ArrayObject *array);
+    void appendToArray(ArrayObject *array, uint64_t value);
     void callNativeFunction();
     void loadNativeFunction();
+    void shade(Object *obj);
+    void collectRoots(bool minor);
+    void markFromRoots(bool tenuredGeneration);
+    [[nodiscard]] bool shouldStartMajorCycle() const;
+    void promoteSurvivors();
+    void minorCollection();
+    void startMajorCycle();
+    void finishMarking();
+    void majorStep();
 
 public:
     VM();
@@ -227,11 +909,29 @@ public:
     void pushPointer(Object *);
     Object *popPointer();
     [[nodiscard]] Object *topPointer() const;
-    void addObject(Object *);
-    void markAll();
-    void sweep();
+    template<typename T, typename... Args>
+    T *newObject(size_t blockSize, Args &&...args) {
+        auto obj = new (allocator.allocate(blockSize)) T(std::forward<Args>(args)...);
+        obj->pooled = true;
+        return obj;
+    }
+    // Links a new object into the nursery. Batches of objects that only
+    // become reachable together pass collect = false for all but the last.
+    void addObject(Object *, bool collect = true);
+    void accountGrowth(Object *, ptrdiff_t bytes);
+    void writeBarrier(Object *);
+    [[nodiscard]] size_t heapSize() const;
 
-    void run(const Program &program);
+    void run(Program &program);
     size_t stackSize{};
     size_t pointersStackSize{};
+    std::chrono::microseconds gcPauseBudget{500};
+    size_t gcStepInterval = 4096;
+    size_t gcNurserySize = 256 * 1024;
+    size_t gcMinHeap = 4 * 1024 * 1024;
+    double gcGrowthFactor = 1.0;
+    size_t gcMarkThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t gcParallelMarkThreshold = 4096;
+    size_t sortThreads = std::max(1u, std::thread::hardware_concurrency());
+    size_t sortParallelThreshold = 1 << 16;
 };
@@ -21,16 +21,116 @@ void printTopStack(const VM &vm, const Program &program) {
         } break;
         case VariableType::Object: {
             auto obj = vm.topPointer();
+            auto print = [](VariableType::Type type, uint64_t value) {
+                switch (type) {
+                    case VariableType::Bool:
+                        std::cout << (value == 0 ? "false" : "true");
+                        break;
+                    case VariableType::I64:
+                        std::cout << (int64_t) value;
+                        break;
+                    case VariableType::F64:
+                        std::cout << std::bit_cast<double>(value);
+                        break;
+                    case VariableType::Object:
+                        if (((Object *) value)->objType == Object::Type::String) {
+                            std::cout << '"' << ((StringObject *) value)->view() << '"';
+                            break;
+                        }
+                        [[fallthrough]];
+                    default:
+                        std::cout << "<object>";
+                }
+            };
             if (obj->objType == Object::Type::String) {
-                std::cout << static_cast<StringObject *>(obj)->chars << std::endl;
+                std::cout << static_cast<StringObject *>(obj)->view() << std::endl;
             } else if (obj->objType == Object::Type::Array) {
                 auto array = static_cast<ArrayObject *>(obj);
                 std::cout << "[";
                 for (size_t i = 0; i < array->size; i++) {
-                    std::cout << array->data[i];
+                    switch (array->elementType) {
+                        case ArrayObject::ElementType::I64:
+                        case ArrayObject::ElementType::I8:
+                        case ArrayObject::ElementType::I16:
+                        case ArrayObject::ElementType::I32:
+                        case ArrayObject::ElementType::U8:
+                        case ArrayObject::ElementType::U32:
+                            std::cout << (int64_t) array->get(i);
+                            break;
+                        case ArrayObject::ElementType::F64:
+                        case ArrayObject::ElementType::F32:
+                            std::cout << std::bit_cast<double>(array->get(i));
+                            break;
+                        case ArrayObject::ElementType::Bool:
+                            std::cout << (array->get(i) ? "true" : "false");
+                            break;
+                        case ArrayObject::ElementType::Object:
+                            std::cout << '"' << ((StringObject *) array->get(i))->view() << '"';
+                            break;
+                    }
                     if (i != array->size - 1) std::cout << ", ";
                 }
                 std::cout << "]" << std::endl;
+            } else if (obj->objType == Object::Type::Map) {
+                auto map = static_cast<MapObject *>(obj);
+                std::cout << "{";
+                for (size_t i = 0, printed = 0; i < map->capacity; i++) {
+                    if (map->control[i] & 0x80) continue;
+                    print(map->keyType, map->keys[i]);
+                    std::cout << ": ";
+                    print(map->valueType, map->values[i]);
+                    if (++printed != map->size) std::cout << ", ";
+                }
+                std::cout << "}" << std::endl;
+            } else if (obj->objType == Object::Type::Matrix) {
+                auto matrix = static_cast<MatrixObject *>(obj);
+                std::cout << "[";
+                for (size_t i = 0; i < matrix->rows; i++) {
+                    std::cout << "[";
+                    for (size_t j = 0; j < matrix->cols; j++) {
+                        if (matrix->elementType == VariableType::F64)
+                            std::cout << std::bit_cast<double>(matrix->at(i, j));
+                        else
+                            std::cout << (int64_t) matrix->at(i, j);
+                        if (j != matrix->cols - 1) std::cout << ", ";
+                    }
+                    std::cout << "]";
+                    if (i != matrix->rows - 1) std::cout << ", ";
+                }
+                std::cout << "]" << std::endl;
+            } else if (obj->objType == Object::Type::Struct) {
+                auto object = static_cast<StructObject *>(obj);
+                auto &fields = object->layout->fields;
+                std::cout << object->layout->name << "(";
+                for (size_t i = 0; i < fields.size(); i++) {
+                    std::cout << fields[i].name << ": ";
+                    print(fields[i].type->type, object->fields()[fields[i].slot]);
+                    if (i != fields.size() - 1) std::cout << ", ";
+                }
+                std::cout << ")" << std::endl;
+            } else if (obj->objType == Object::Type::Soa) {
+                auto soa = static_cast<SoaObject *>(obj);
+                auto &fields = soa->layout->fields;
+                std::cout << "[";
+                for (size_t i = 0; i < soa->size; i++) {
+                    std::cout << soa->layout->name << "(";
+                    for (size_t j = 0; j < fields.size(); j++) {
+                        std::cout << fields[j].name << ": ";
+                        print(fields[j].type->type, soa->columns()[fields[j].slot]->get(i));
+                        if (j != fields.size() - 1) std::cout << ", ";
+                    }
+                    std::cout << ")";
+                    if (i != soa->size - 1) std::cout << ", ";
+                }
+                std::cout << "]" << std::endl;
+            } else if (obj->objType == Object::Type::CompressedArray) {
+                auto compressed = static_cast<CompressedArrayObject *>(obj);
+                std::cout << "compressed[";
+                for (size_t i = 0; i < compressed->size; i++) {
+                    std::cout << (int64_t) compressed->get(i);
+                    if (i != compressed->size - 1) std::cout << ", ";
+                }
+                std::cout << "]" << std::endl;
             }
         } break;
         default:
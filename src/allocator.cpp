@@ -0,0 +1,65 @@
+#include "allocator.h"
+#include <cstring>
+#include <stdexcept>
+
+Allocator::Allocator() {
+    size_t index = 0;
+    for (size_t i = 0; i <= maxSize / granularity; i++) {
+        while (sizeClasses[index] < i * granularity)
+            index++;
+        classIndex[i] = index;
+    }
+}
+Allocator::~Allocator() {
+    for (auto slab: slabs)
+        free(slab);
+}
+void *Allocator::refill(SizeClass &sizeClass, size_t blockSize) {
+    {
+        std::lock_guard lock(sizeClass.remoteMutex);
+        sizeClass.freeList = sizeClass.remoteList;
+        sizeClass.remoteList = nullptr;
+    }
+    if (sizeClass.freeList != nullptr) {
+        auto block = sizeClass.freeList;
+        sizeClass.freeList = block->next;
+        return block;
+    }
+    if (sizeClass.cursor == nullptr || sizeClass.cursor + blockSize > sizeClass.end) {
+        auto slab = static_cast<char *>(malloc(slabSize));
+        if (slab == nullptr)
+            throw std::runtime_error("Memory allocation failure!");
+        slabs.push_back(slab);
+        sizeClass.cursor = slab;
+        sizeClass.end = slab + slabSize;
+    }
+    auto block = sizeClass.cursor;
+    sizeClass.cursor += blockSize;
+    return block;
+}
+void Allocator::deallocateConcurrent(void *ptr, size_t size) {
+    if (ptr == nullptr) return;
+    if (size > maxSize) return free(ptr);
+    auto &sizeClass = classes[classIndex[(size + granularity - 1) / granularity]];
+    auto block = static_cast<FreeBlock *>(ptr);
+    std::lock_guard lock(sizeClass.remoteMutex);
+    block->next = sizeClass.remoteList;
+    sizeClass.remoteList = block;
+}
+void *Allocator::reallocate(void *ptr, size_t oldSize, size_t newSize) {
+    if (ptr != nullptr && blockSize(oldSize) == blockSize(newSize) && newSize <= maxSize)
+        return ptr;
+    if (ptr != nullptr && oldSize > maxSize && newSize > maxSize) {
+        auto newPtr = realloc(ptr, newSize);
+        if (newPtr == nullptr)
+            throw std::runtime_error("Memory allocation failure!");
+        return newPtr;
+    }
+    auto newPtr = allocate(newSize);
+    if (newPtr == nullptr && newSize != 0)
+        throw std::runtime_error("Memory allocation failure!");
+    if (ptr != nullptr)
+        memcpy(newPtr, ptr, oldSize < newSize ? oldSize : newSize);
+    deallocate(ptr, oldSize);
+    return newPtr;
+}
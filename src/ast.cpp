@@ -5,6 +5,7 @@
 #include <sstream>
 #include <utility>
 #include <memory>
+#include <unordered_set>
 
 Node::Node(Token token) : token(std::move(token)) {
     nodeType = Type::Node;
@@ -17,7 +18,7 @@ bool Node::operator==(const AbstractSyntaxTree &other) const {
 void Node::compile(Program &program, Segment &segment) const {
     switch (token.type) {
         case String: {
-            auto string = new StringObject(token.value.size(), strdup(token.value.c_str()));
+            auto string = program.intern(token.value);
             segment.instructions.push_back(
                     Instruction{
                             .type = Instruction::InstructionType::LoadObject,
@@ -59,10 +60,301 @@ bool BinaryExpression::operator==(const AbstractSyntaxTree &other) const {
            op == otherBinaryExpression.op;
 }
 
+static Instruction arrayElementInstruction(Program &program, Segment &segment, const std::string &identifier, bool store) {
+    bool isLocal;
+    if (segment.find_local(identifier) != -1)
+        isLocal = true;
+    else if (program.find_global(identifier) != -1)
+        isLocal = false;
+    else
+        throw std::runtime_error("[ArrayAccess::compile] Identifier not found: " + identifier);
+    auto &variable = isLocal ? segment.locals[identifier] : program.segments[0].locals[identifier];
+    if (variable.type->type != VariableType::Array)
+        throw std::runtime_error("[ArrayAccess::compile] Not an array: " + identifier);
+    auto elementType = ((ArrayObjectType *) variable.type)->elementType;
+    auto instruction = store ? (isLocal ? ArrayInstruction::StoreToLocalArray : ArrayInstruction::StoreToGlobalArray)
+                             : (isLocal ? ArrayInstruction::LoadFromLocalArray : ArrayInstruction::LoadFromGlobalArray);
+    return {
+            .type = getArrayInstruction(instruction, elementType),
+            .params = {.index = variable.index},
+    };
+}
+
+// Wraps a value about to be stored in a fixed-width variable
+static void narrowValue(Segment &segment, const VariableType *type) {
+    if (type->narrow)
+        segment.instructions.push_back({.type = Instruction::Narrow, .params = {.index = (size_t) storageOf(type)}});
+}
+
+// Compiles a value that is about to be stored or passed on. Strings that
+// escape this way may become shared, so they stop being appended in place.
+static void compileValue(Program &program, Segment &segment, AbstractSyntaxTree *value, VariableType *type) {
+    if (value->nodeType == AbstractSyntaxTree::Type::List && type->type == VariableType::Array)
+        return dynamic_cast<List *>(value)->compileAs(program, segment, ((ArrayObjectType *) type)->elementType);
+    value->compile(program, segment);
+    if (type->type == VariableType::Object)
+        segment.instructions.push_back({.type = Instruction::FreezeString});
+}
+
+// Pushes the fields of a record built from a constructor call, each kind in
+// slot order onto its own stack
+static void compileStructFields(Program &program, Segment &segment, const StructType *structType,
+                                const std::vector<AbstractSyntaxTree *> &arguments) {
+    if (arguments.size() != structType->fields.size())
+        throw std::runtime_error("[FunctionCall::compile] Wrong number of fields for " + structType->name);
+    for (size_t i = 0; i < arguments.size(); i++) {
+        auto fieldType = structType->fields[i].type;
+        compileValue(program, segment, arguments[i], fieldType);
+        typeCast(segment.instructions, deduceType(program, segment, arguments[i])->type, fieldType);
+    }
+}
+
+static VariableType *findVariableType(Program &program, Segment &segment, const std::string &identifier) {
+    if (segment.find_local(identifier) != -1)
+        return segment.locals[identifier].type;
+    if (program.find_global(identifier) != -1)
+        return program.segments[0].locals[identifier].type;
+    return nullptr;
+}
+static MapObjectType *findMapType(Program &program, Segment &segment, const std::string &identifier) {
+    auto type = findVariableType(program, segment, identifier);
+    return type != nullptr && type->type == VariableType::Map ? (MapObjectType *) type : nullptr;
+}
+static SoaObjectType *findSoaType(Program &program, Segment &segment, const std::string &identifier) {
+    auto type = findVariableType(program, segment, identifier);
+    return type != nullptr && type->type == VariableType::Soa ? (SoaObjectType *) type : nullptr;
+}
+static MatrixObjectType *findMatrixType(Program &program, Segment &segment, const std::string &identifier) {
+    auto type = findVariableType(program, segment, identifier);
+    if (type == nullptr || type->type != VariableType::Matrix)
+        throw std::runtime_error("[MatrixAccess::compile] Not a matrix: " + identifier);
+    return (MatrixObjectType *) type;
+}
+
+// Pushes the matrix and the row and column of m[row, col]
+static void compileMatrixIndex(Program &program, Segment &segment, const MatrixAccess &access) {
+    emitLoad(program, segment, access.identifier.token.value);
+    access.row->compile(program, segment);
+    typeCast(segment.instructions, deduceType(program, segment, access.row)->type, VariableType::I64);
+    access.col->compile(program, segment);
+    typeCast(segment.instructions, deduceType(program, segment, access.col)->type, VariableType::I64);
+}
+
+// Pushes the records and the index of ps[i]
+static void compileSoaIndex(Program &program, Segment &segment, const ArrayAccess &access) {
+    emitLoad(program, segment, access.identifier.token.value);
+    access.index->compile(program, segment);
+    typeCast(segment.instructions, deduceType(program, segment, access.index)->type, VariableType::I64);
+}
+// ps[i].field touches only the column of that field
+static bool isSoaElement(Program &program, Segment &segment, const AbstractSyntaxTree *object) {
+    return object->nodeType == AbstractSyntaxTree::Type::ArrayAccess &&
+           findSoaType(program, segment, dynamic_cast<const ArrayAccess *>(object)->identifier.token.value) != nullptr;
+}
+
+// Pushes the map and the key of m[key], the key converted to the key type
+static void compileMapKey(Program &program, Segment &segment, const ArrayAccess &access, MapObjectType *mapType, bool store) {
+    emitLoad(program, segment, access.identifier.token.value);
+    if (store)
+        compileValue(program, segment, access.index, mapType->keyType);
+    else
+        access.index->compile(program, segment);
+    typeCast(segment.instructions, deduceType(program, segment, access.index)->type, mapType->keyType);
+}
+
+// Value of an int literal operand
+static std::optional<int64_t> literalInt(const AbstractSyntaxTree *ast) {
+    if (ast->nodeType != AbstractSyntaxTree::Type::Node)
+        return std::nullopt;
+    auto &token = dynamic_cast<const Node *>(ast)->token;
+    if (token.type != Number)
+        return std::nullopt;
+    return convert<int64_t>(token.value);
+}
+
+static void compileBitwise(Program &program, Segment &segment, const BinaryExpression &expression) {
+    for (auto operand: {expression.left, expression.right}) {
+        auto type = deduceType(program, segment, operand)->type;
+        if (type != VariableType::I64 && type != VariableType::Bool)
+            throw std::runtime_error("[BinaryExpression::compile] Bitwise operators need int operands!");
+    }
+    auto shiftLeft = expression.op.type == ShiftLeft;
+    expression.left->compile(program, segment);
+    if (shiftLeft || expression.op.type == ShiftRight) {
+        if (auto amount = literalInt(expression.right)) {
+            if ((*amount & 63) != 0)
+                segment.instructions.push_back({
+                        .type = shiftLeft ? Instruction::ShiftLeftConstI64 : Instruction::ShiftRightConstI64,
+                        .params = {.index = (size_t) (*amount & 63)},
+                });
+            return;
+        }
+    }
+    expression.right->compile(program, segment);
+    switch (expression.op.type) {
+        case BitAnd:
+            return segment.instructions.push_back({.type = Instruction::BitAndI64});
+        case BitOr:
+            return segment.instructions.push_back({.type = Instruction::BitOrI64});
+        case BitXor:
+            return segment.instructions.push_back({.type = Instruction::BitXorI64});
+        case ShiftLeft:
+            return segment.instructions.push_back({.type = Instruction::ShiftLeftI64});
+        default:
+            return segment.instructions.push_back({.type = Instruction::ShiftRightI64});
+    }
+}
+
+static void requireBool(Program &program, Segment &segment, AbstractSyntaxTree *operand) {
+    if (deduceType(program, segment, operand)->type != VariableType::Bool)
+        throw std::runtime_error("[BinaryExpression::compile] Logical operators need bool operands!");
+}
+
+// Int comparison that jumps when it holds, or when it fails if !jumpIf
+static Instruction::InstructionType comparisonJump(int op, bool jumpIf) {
+    switch (op) {
+        case Equal:
+            return jumpIf ? Instruction::JumpIfEqualI64 : Instruction::JumpIfNotEqualI64;
+        case NotEqual:
+            return jumpIf ? Instruction::JumpIfNotEqualI64 : Instruction::JumpIfEqualI64;
+        case Less:
+            return jumpIf ? Instruction::JumpIfLessI64 : Instruction::JumpIfGreaterEqualI64;
+        case LessEqual:
+            return jumpIf ? Instruction::JumpIfLessEqualI64 : Instruction::JumpIfGreaterI64;
+        case Greater:
+            return jumpIf ? Instruction::JumpIfGreaterI64 : Instruction::JumpIfLessEqualI64;
+        case GreaterEqual:
+            return jumpIf ? Instruction::JumpIfGreaterEqualI64 : Instruction::JumpIfLessI64;
+        default:
+            return Instruction::Invalid;
+    }
+}
+
+static void patchJumps(Segment &segment, const std::vector<size_t> &jumps, size_t target) {
+    for (auto jump: jumps)
+        segment.instructions[jump].params.index = target;
+}
+
+// Compiles a condition as branches that jump when it evaluates to jumpIf and
+// fall through otherwise, adding the jumps to be patched by the caller. The
+// right operand of && and || only runs when the left one does not decide the
+// result, and int comparisons branch directly instead of pushing a bool.
+static void compileBranch(Program &program, Segment &segment, AbstractSyntaxTree *condition, bool jumpIf,
+                          std::vector<size_t> &jumps) {
+    if (condition->nodeType == AbstractSyntaxTree::Type::UnaryExpression) {
+        auto unary = dynamic_cast<UnaryExpression *>(condition);
+        if (unary->op.type == Not) {
+            requireBool(program, segment, unary->expression);
+            return compileBranch(program, segment, unary->expression, !jumpIf, jumps);
+        }
+    }
+    if (condition->nodeType == AbstractSyntaxTree::Type::BinaryExpression) {
+        auto binary = dynamic_cast<BinaryExpression *>(condition);
+        auto op = binary->op.type;
+        if (op == And || op == Or) {
+            requireBool(program, segment, binary->left);
+            requireBool(program, segment, binary->right);
+            // Either operand decides a false && or a true ||, otherwise the
+            // left one only skips over the right one
+            if ((op == And) != jumpIf) {
+                compileBranch(program, segment, binary->left, jumpIf, jumps);
+                compileBranch(program, segment, binary->right, jumpIf, jumps);
+            } else {
+                std::vector<size_t> skip;
+                compileBranch(program, segment, binary->left, !jumpIf, skip);
+                compileBranch(program, segment, binary->right, jumpIf, jumps);
+                patchJumps(segment, skip, segment.instructions.size());
+            }
+            return;
+        }
+        auto jump = comparisonJump(op, jumpIf);
+        if (jump != Instruction::Invalid &&
+            deduceType(program, segment, binary->left)->type == VariableType::I64 &&
+            deduceType(program, segment, binary->right)->type == VariableType::I64) {
+            binary->left->compile(program, segment);
+            binary->right->compile(program, segment);
+            jumps.push_back(segment.instructions.size());
+            segment.instructions.push_back({.type = jump});
+            return;
+        }
+    }
+    if (condition->nodeType == AbstractSyntaxTree::Type::Node) {
+        auto &token = dynamic_cast<Node *>(condition)->token;
+        if (token.type == True || token.type == False) {
+            if ((token.type == True) == jumpIf) {
+                jumps.push_back(segment.instructions.size());
+                segment.instructions.push_back({.type = Instruction::Jump});
+            }
+            return;
+        }
+    }
+    condition->compile(program, segment);
+    jumps.push_back(segment.instructions.size());
+    segment.instructions.push_back({.type = jumpIf ? Instruction::JumpIfTrue : Instruction::JumpIfFalse});
+}
+
 void BinaryExpression::compile(Program &program, Segment &segment) const {
     if (op.type == Assign) {
-        right->compile(program, segment);
-        emitStore(program, segment, dynamic_cast<Node &>(*left).token.value);
+        if (left->nodeType == AbstractSyntaxTree::Type::FieldAccess) {
+            auto fieldAccess = dynamic_cast<FieldAccess *>(left);
+            auto &field = findField(program, segment, *fieldAccess);
+            if (deduceType(program, segment, fieldAccess->object)->type == VariableType::Soa)
+                throw std::runtime_error("[BinaryExpression::compile] Cannot assign to a column: " + field.name);
+            compileValue(program, segment, right, field.type);
+            typeCast(segment.instructions, deduceType(program, segment, right)->type, field.type);
+            if (isSoaElement(program, segment, fieldAccess->object)) {
+                compileSoaIndex(program, segment, *dynamic_cast<ArrayAccess *>(fieldAccess->object));
+                segment.instructions.push_back({
+                        .type = MapObject::isObjectType(field.type->type) ? Instruction::StoreSoaObjectField : Instruction::StoreSoaField,
+                        .params = {.index = StructObject::packField(field.slot, field.type->type)},
+                });
+                return;
+            }
+            fieldAccess->object->compile(program, segment);
+            segment.instructions.push_back({
+                    .type = MapObject::isObjectType(field.type->type) ? Instruction::StoreObjectField : Instruction::StoreField,
+                    .params = {.index = StructObject::packField(field.slot, field.type->type)},
+            });
+            return;
+        }
+        if (left->nodeType == AbstractSyntaxTree::Type::MatrixAccess) {
+            auto matrixAccess = dynamic_cast<MatrixAccess *>(left);
+            auto elementType = findMatrixType(program, segment, matrixAccess->identifier.token.value)->elementType;
+            right->compile(program, segment);
+            typeCast(segment.instructions, deduceType(program, segment, right)->type, elementType->type);
+            compileMatrixIndex(program, segment, *matrixAccess);
+            segment.instructions.push_back({.type = Instruction::StoreMatrixElement});
+            return;
+        }
+        if (left->nodeType == AbstractSyntaxTree::Type::ArrayAccess) {
+            auto arrayAccess = dynamic_cast<ArrayAccess *>(left);
+            if (auto mapType = findMapType(program, segment, arrayAccess->identifier.token.value)) {
+                compileMapKey(program, segment, *arrayAccess, mapType, true);
+                compileValue(program, segment, right, mapType->valueType);
+                typeCast(segment.instructions, deduceType(program, segment, right)->type, mapType->valueType);
+                segment.instructions.push_back({
+                        .type = Instruction::MapPut,
+                        .params = {.index = MapObject::packTypes(mapType->keyType->type, mapType->valueType->type)},
+                });
+                return;
+            }
+            auto elementType = deduceType(program, segment, left);
+            compileValue(program, segment, right, elementType);
+            typeCast(segment.instructions, deduceType(program, segment, right)->type, elementType->type);
+            arrayAccess->index->compile(program, segment);
+            segment.instructions.push_back(
+                    arrayElementInstruction(program, segment, arrayAccess->identifier.token.value, true));
+            return;
+        }
+        auto &identifier = dynamic_cast<Node &>(*left).token.value;
+        if (auto type = findVariableType(program, segment, identifier)) {
+            compileValue(program, segment, right, type);
+            if (type->narrow)
+                typeCast(segment.instructions, deduceType(program, segment, right)->type, type);
+        } else {
+            right->compile(program, segment);
+        }
+        emitStore(program, segment, identifier);
         return;
     }
     if ((op.type == IncrementAssign || op.type == DecrementAssign) &&
@@ -79,10 +371,41 @@ void BinaryExpression::compile(Program &program, Segment &segment) const {
                         right->compile(program, segment);
                         segment.instructions.push_back(Instruction{.type = Instruction::InstructionType::AddI64});
                         break;
-                    case VariableType::Array: {
+                    case VariableType::Object: {
                         right->compile(program, segment);
+                        if (deduceType(program, segment, right)->type != VariableType::Object)
+                            throw std::runtime_error("[BinaryExpression::compile] Only strings can be appended to strings!");
+                        segment.instructions.push_back({
+                                .type = segment.find_local(node->token.value) != -1 ? Instruction::AppendToLocalString
+                                                                                    : Instruction::AppendToGlobalString,
+                                .params = {.index = varType.index},
+                        });
+                        return;
+                    }
+                    case VariableType::Array: {
+                        auto elementType = ((ArrayObjectType *) varType.type)->elementType;
+                        compileValue(program, segment, right, elementType);
+                        typeCast(segment.instructions, deduceType(program, segment, right)->type, elementType->type);
                         left->compile(program, segment);
-                        segment.instructions.push_back({.type = Instruction::AppendToArray});
+                        segment.instructions.push_back({
+                                .type = getArrayInstruction(ArrayInstruction::AppendToArray, elementType),
+                        });
+                    } break;
+                    case VariableType::Soa: {
+                        auto recordType = ((SoaObjectType *) varType.type)->recordType;
+                        auto call = dynamic_cast<FunctionCall *>(right);
+                        // A constructor call scatters its fields into the columns without building the record
+                        if (call != nullptr && call->identifier.token.value == recordType->name) {
+                            compileStructFields(program, segment, recordType, call->arguments);
+                            left->compile(program, segment);
+                            segment.instructions.push_back({.type = Instruction::AppendToSoa});
+                        } else {
+                            if (deduceType(program, segment, right) != recordType)
+                                throw std::runtime_error("[BinaryExpression::compile] Only " + recordType->name + " records can be appended!");
+                            right->compile(program, segment);
+                            left->compile(program, segment);
+                            segment.instructions.push_back({.type = Instruction::AppendStructToSoa});
+                        }
                     } break;
                     default:
                         throw std::runtime_error("[BinaryExpression::compile] Invalid varType!");
@@ -102,16 +425,51 @@ void BinaryExpression::compile(Program &program, Segment &segment) const {
             default:
                 throw std::runtime_error("[BinaryExpression::compile] Invalid operator: " + op.value);
         }
+        narrowValue(segment, varType.type);
         emitStore(program, segment, node->token.value);
         return;
     }
 
+    if (isBitwise(op.type))
+        return compileBitwise(program, segment, *this);
+    if (op.type == And || op.type == Or) {
+        std::vector<size_t> falseJumps;
+        compileBranch(program, segment, (AbstractSyntaxTree *) this, false, falseJumps);
+        segment.instructions.push_back({.type = Instruction::LoadI64, .params = {.i64 = 1}});
+        auto endJump = segment.instructions.size();
+        segment.instructions.push_back({.type = Instruction::Jump});
+        patchJumps(segment, falseJumps, segment.instructions.size());
+        segment.instructions.push_back({.type = Instruction::LoadI64, .params = {.i64 = 0}});
+        segment.instructions[endJump].params.index = segment.instructions.size();
+        return;
+    }
+
     auto leftType = deduceType(program, segment, left);
     auto rightType = deduceType(program, segment, right);
+    // Bools are stored as 0 or 1, so they compare as ints
+    if ((op.type == Equal || op.type == NotEqual) &&
+        leftType->type == VariableType::Bool && rightType->type == VariableType::Bool) {
+        left->compile(program, segment);
+        right->compile(program, segment);
+        segment.instructions.push_back({.type = op.type == Equal ? Instruction::EqualI64 : Instruction::NotEqualI64});
+        return;
+    }
     auto finalType = biggestType(leftType->type, rightType->type);
 
     left->compile(program, segment);
     typeCast(segment.instructions, leftType->type, finalType);
+    // Multiplying by a power of two is a shift
+    if (op.type == Multiply && finalType == VariableType::I64 && rightType->type == VariableType::I64) {
+        auto factor = literalInt(right);
+        if (factor && *factor > 0 && std::has_single_bit((uint64_t) *factor)) {
+            if (*factor != 1)
+                segment.instructions.push_back({
+                        .type = Instruction::ShiftLeftConstI64,
+                        .params = {.index = (size_t) std::countr_zero((uint64_t) *factor)},
+                });
+            return;
+        }
+    }
     right->compile(program, segment);
     typeCast(segment.instructions, rightType->type, finalType);
     switch (op.type) {
@@ -179,7 +537,7 @@ void Declaration::compile(Program &program, Segment &segment) const {
     if (!type.has_value()) {
         if (value.has_value()) {
             auto varType = deduceType(program, segment, value.value());
-            value.value()->compile(program, segment);
+            compileValue(program, segment, value.value(), varType);
             segment.declare_variable(identifier.token.value, varType);
             emitStore(program, segment, identifier.token.value);
         } else {
@@ -191,27 +549,46 @@ void Declaration::compile(Program &program, Segment &segment) const {
         case AbstractSyntaxTree::Type::Node: {
             switch (((Node *) type.value())->token.type) {
                 case Str: {
-                    value.value()->compile(program, segment);
-                    segment.declare_variable(identifier.token.value, new VariableType(VariableType::Object));
+                    auto varType = new VariableType(VariableType::Object);
+                    compileValue(program, segment, value.value(), varType);
+                    segment.declare_variable(identifier.token.value, varType);
                     emitStore(program, segment, identifier.token.value);
                 } break;
-                case Bool:
+                case Bool: {
+                    if (!value.has_value()) {
+                        segment.instructions.push_back({
+                                .type = Instruction::InstructionType::LoadI64,
+                                .params = {.i64 = 0},
+                        });
+                    } else {
+                        if (deduceType(program, segment, value.value())->type != VariableType::Bool)
+                            throw std::runtime_error("[Declaration::compile] Bool variables need a bool value!");
+                        value.value()->compile(program, segment);
+                    }
+                    segment.declare_variable(identifier.token.value, new VariableType(VariableType::Type::Bool));
+                    segment.instructions.push_back({
+                            .type = segment.id == 0 ? Instruction::InstructionType::StoreGlobalI64 : Instruction::InstructionType::StoreLocalI64,
+                            .params = {.index = segment.find_local(identifier.token.value)},
+                    });
+                } break;
                 case Int: {
                     if (!value.has_value()) {
                         segment.instructions.push_back({
                                 .type = Instruction::InstructionType::LoadI64,
                                 .params = {.i64 = 0},
                         });
-                    } else if (((Node *) value.value())->token.type == Number) {
+                    } else if (value.value()->nodeType == AbstractSyntaxTree::Type::Node &&
+                               ((Node *) value.value())->token.type == Number) {
                         segment.instructions.push_back({
                                 .type = Instruction::InstructionType::LoadI64,
                                 .params = {.i64 = convert<int64_t>(((Node *) value.value())->token.value)},
                         });
                     } else {
-                        auto from = std::unique_ptr<VariableType>(deduceType(program, segment, value.value()));
-                        auto to = std::unique_ptr<VariableType>(varTypeConvert(type.value()));
+                        // Deduced types may be shared with variables and functions
+                        auto from = deduceType(program, segment, value.value())->type;
+                        auto to = std::unique_ptr<VariableType>(varTypeConvert(program, type.value()));
                         value.value()->compile(program, segment);
-                        typeCast(segment.instructions, from->type, to->type);
+                        typeCast(segment.instructions, from, to->type);
                     }
                     segment.declare_variable(identifier.token.value, new VariableType(VariableType::Type::I64));
                     segment.instructions.push_back({
@@ -225,7 +602,8 @@ void Declaration::compile(Program &program, Segment &segment) const {
                                 .type = Instruction::InstructionType::LoadF64,
                                 .params = {.i64 = 0},
                         });
-                    } else if (((Node *) value.value())->token.type == DecimalNumber) {
+                    } else if (value.value()->nodeType == AbstractSyntaxTree::Type::Node &&
+                               ((Node *) value.value())->token.type == DecimalNumber) {
                         segment.instructions.push_back({
                                 .type = Instruction::InstructionType::LoadF64,
                                 .params = {.f64 = convert<double>(((Node *) value.value())->token.value)},
@@ -239,52 +617,158 @@ void Declaration::compile(Program &program, Segment &segment) const {
                             .params = {.index = segment.find_local(identifier.token.value)},
                     });
                 } break;
+                case Int8:
+                case Int16:
+                case Int32:
+                case UInt8:
+                case UInt:
+                case Float32: {
+                    auto varType = varTypeConvert(program, type.value());
+                    if (!value.has_value()) {
+                        segment.instructions.push_back({
+                                .type = varType->type == VariableType::F64 ? Instruction::LoadF64 : Instruction::LoadI64,
+                                .params = {.i64 = 0},
+                        });
+                    } else {
+                        auto from = deduceType(program, segment, value.value())->type;
+                        value.value()->compile(program, segment);
+                        typeCast(segment.instructions, from, varType);
+                    }
+                    segment.declare_variable(identifier.token.value, varType);
+                    emitStore(program, segment, identifier.token.value);
+                } break;
+                case Identifier: {
+                    auto structType = varTypeConvert(program, type.value());
+                    if (!value.has_value())
+                        throw std::runtime_error("[Declaration::compile] Struct variables must be initialized!");
+                    compileValue(program, segment, value.value(), structType);
+                    segment.declare_variable(identifier.token.value, structType);
+                    emitStore(program, segment, identifier.token.value);
+                } break;
+                case Compressed: {
+                    auto varType = varTypeConvert(program, type.value());
+                    if (!value.has_value() || deduceType(program, segment, value.value())->type != VariableType::CompressedArray)
+                        throw std::runtime_error("[Declaration::compile] Compressed arrays are built with compress()!");
+                    value.value()->compile(program, segment);
+                    segment.declare_variable(identifier.token.value, varType);
+                    emitStore(program, segment, identifier.token.value);
+                } break;
                 default:
                     throw std::runtime_error("[Declaration::compile] Unimplemented type handler!");
             }
         } break;
+        case AbstractSyntaxTree::Type::StructDeclaration: {
+            auto &name = identifier.token.value;
+            if (program.structs.contains(name))
+                throw std::runtime_error("[Declaration::compile] Struct already declared: " + name);
+            // Registered first so fields can refer to the struct itself, and
+            // dropped again if a field is rejected so the name stays free
+            auto structType = (program.structs[name] = std::make_unique<StructType>(name)).get();
+            try {
+                for (auto field: ((StructDeclaration *) type.value())->fields) {
+                    if (structType->find_field(field->identifier.token.value) != nullptr)
+                        throw std::runtime_error("[Declaration::compile] Duplicate field: " + field->identifier.token.value);
+                    structType->fields.push_back({
+                            .name = field->identifier.token.value,
+                            .type = varTypeConvert(program, field->type.value()),
+                    });
+                }
+            } catch (std::exception &) {
+                program.structs.erase(name);
+                throw;
+            }
+            for (auto &field: structType->fields) {
+                if (MapObject::isObjectType(field.type->type))
+                    field.slot = structType->pointerFields++;
+            }
+            auto slot = structType->pointerFields;
+            for (auto &field: structType->fields) {
+                if (!MapObject::isObjectType(field.type->type))
+                    field.slot = slot++;
+            }
+        } break;
         case AbstractSyntaxTree::Type::FunctionDeclaration: {
             auto functionDeclaration = (FunctionDeclaration *) type.value();
             auto newSegment = Segment{.id = program.segments.size()};
-            auto returnType = varTypeConvert(functionDeclaration->returnType);
+            auto returnType = varTypeConvert(program, functionDeclaration->returnType);
             auto arguments = std::vector<VariableType *>();
             newSegment.returnType = returnType;
             for (auto arg: functionDeclaration->arguments)
-                arguments.push_back(varTypeConvert(arg->type.value()));
+                arguments.push_back(varTypeConvert(program, arg->type.value()));
             segment.declare_function(identifier.token.value,
                                      new FunctionType(returnType, arguments),
                                      program.segments.size());
             for (auto argument: functionDeclaration->arguments) {
                 auto argType = deduceType(program, segment, argument);
                 if (argType->type == VariableType::Object ||
-                    argType->type == VariableType::Array) {
+                    argType->type == VariableType::Array ||
+                    argType->type == VariableType::Map ||
+                    argType->type == VariableType::Matrix ||
+                    argType->type == VariableType::Struct ||
+                    argType->type == VariableType::Soa ||
+                    argType->type == VariableType::CompressedArray) {
                     newSegment.number_of_arg_ptr++;
                 } else {
                     newSegment.number_of_args++;
                 }
                 newSegment.declare_variable(argument->identifier.token.value, argType);
             }
-            value.value()->compile(program, newSegment);
-            if (returnType->type == VariableType::Type::Void &&
-                newSegment.instructions.back().type != Instruction::InstructionType::Return) {
-                newSegment.instructions.push_back({
-                        .type = Instruction::InstructionType::Return,
-                });
-            }
+            newSegment.body = value.value();
             program.segments.push_back(newSegment);
         } break;
         case AbstractSyntaxTree::Type::ArrayType: {
             if (value.has_value()) {
-                value.value()->compile(program, segment);
-                segment.declare_variable(
-                        identifier.token.value,
-                        varTypeConvert(type.value()));
+                auto arrayType = varTypeConvert(program, type.value());
+                compileValue(program, segment, value.value(), arrayType);
+                segment.declare_variable(identifier.token.value, arrayType);
                 segment.instructions.push_back({
                         .type = segment.id == 0 ? Instruction::InstructionType::StoreGlobalObject : Instruction::InstructionType::StoreLocalObject,
                         .params = {.index = segment.find_local(identifier.token.value)},
                 });
             }
         } break;
+        case AbstractSyntaxTree::Type::MapType: {
+            auto mapType = (MapObjectType *) varTypeConvert(program, type.value());
+            if (value.has_value()) {
+                compileValue(program, segment, value.value(), mapType);
+            } else {
+                segment.instructions.push_back({
+                        .type = Instruction::MakeMap,
+                        .params = {.index = MapObject::packTypes(mapType->keyType->type, mapType->valueType->type)},
+                });
+            }
+            segment.declare_variable(identifier.token.value, mapType);
+            emitStore(program, segment, identifier.token.value);
+        } break;
+        case AbstractSyntaxTree::Type::SoaType: {
+            auto soaType = (SoaObjectType *) varTypeConvert(program, type.value());
+            if (value.has_value())
+                compileValue(program, segment, value.value(), soaType);
+            else
+                segment.instructions.push_back({.type = Instruction::MakeSoa, .params = {.ptr = soaType->recordType}});
+            segment.declare_variable(identifier.token.value, soaType);
+            emitStore(program, segment, identifier.token.value);
+        } break;
+        case AbstractSyntaxTree::Type::MatrixType: {
+            auto matrixType = (MatrixObjectType *) varTypeConvert(program, type.value());
+            auto shape = (MatrixType *) type.value();
+            if (value.has_value()) {
+                compileValue(program, segment, value.value(), matrixType);
+            } else if (shape->rows != nullptr) {
+                shape->rows->compile(program, segment);
+                typeCast(segment.instructions, deduceType(program, segment, shape->rows)->type, VariableType::I64);
+                shape->cols->compile(program, segment);
+                typeCast(segment.instructions, deduceType(program, segment, shape->cols)->type, VariableType::I64);
+                segment.instructions.push_back({
+                        .type = Instruction::MakeMatrix,
+                        .params = {.index = matrixType->elementType->type},
+                });
+            } else {
+                throw std::runtime_error("[Declaration::compile] Matrix declarations need a shape!");
+            }
+            segment.declare_variable(identifier.token.value, matrixType);
+            emitStore(program, segment, identifier.token.value);
+        } break;
         default:
             throw std::runtime_error("[Declaration::compile] Invalid type!");
     }
@@ -346,10 +830,10 @@ bool ReturnStatement::operator==(const AbstractSyntaxTree &other) const {
 }
 void ReturnStatement::compile(Program &program, Segment &segment) const {
     if (expression != nullptr) {
-        expression->compile(program, segment);
         auto type = deduceType(program, segment, expression);
-        if (type->type != segment.returnType->type)
-            typeCast(segment.instructions, type->type, segment.returnType->type);
+        compileValue(program, segment, expression, type);
+        if (type->type != segment.returnType->type || segment.returnType->narrow)
+            typeCast(segment.instructions, type->type, segment.returnType);
     }
     if (expression == nullptr && segment.returnType->type != VariableType::Type::Void)
         throw std::runtime_error("[ReturnStatement::compile] Return type mismatch!");
@@ -371,6 +855,11 @@ bool TypeCast::operator==(const AbstractSyntaxTree &other) const {
     auto &otherTypeCast = dynamic_cast<const TypeCast &>(other);
     return *expression == *otherTypeCast.expression && *type == *otherTypeCast.type;
 }
+void TypeCast::compile(Program &program, Segment &segment) const {
+    auto to = varTypeConvert(program, type);
+    expression->compile(program, segment);
+    typeCast(segment.instructions, deduceType(program, segment, expression)->type, to);
+}
 
 FunctionCall::FunctionCall(Node identifier, const std::vector<AbstractSyntaxTree *> &arguments)
     : identifier(std::move(identifier)), arguments(arguments) {
@@ -410,21 +899,44 @@ void FunctionCall::compile(Program &program, Segment &segment) const {
         }
         segment.instructions.push_back({
                 .type = Instruction::LoadObject,
-                .params = {.ptr = new DynamicFunctionObject(argName->token.value, funcArgs)},
+                .params = {.ptr = makeObject<DynamicFunctionObject>(sizeof(DynamicFunctionObject),
+                                                                  argName->token.value, funcArgs)},
         });
         emitLoad(program, segment, identifier.token.value);
         segment.instructions.push_back({.type = Instruction::InstructionType::CallNative});
         return;
     }
+    if (auto it = program.structs.find(identifier.token.value); it != program.structs.end()) {
+        auto structType = it->second.get();
+        compileStructFields(program, segment, structType, arguments);
+        segment.instructions.push_back({.type = Instruction::MakeStruct, .params = {.ptr = structType}});
+        return;
+    }
+    if (auto builtin = findBuiltin(program, segment, identifier.token.value, arguments)) {
+        if (arguments.size() != builtin->arguments.size())
+            throw std::runtime_error("[FunctionCall::compile] Wrong number of arguments for " + identifier.token.value);
+        for (int i = 0; i < arguments.size(); i++) {
+            arguments[i]->compile(program, segment);
+            typeCast(segment.instructions,
+                     deduceType(program, segment, arguments[i])->type,
+                     builtin->arguments[i]);
+        }
+        Instruction instruction{.type = builtin->instruction};
+        // Map instructions learn from the key type which stack the key is on
+        if (!builtin->arguments.empty() && builtin->arguments.front() == VariableType::Map)
+            instruction.params.index = MapObject::packTypes(builtin->elementType, VariableType::Invalid);
+        segment.instructions.push_back(instruction);
+        return;
+    }
     auto function = program.find_function(segment, identifier.token.value);
     auto functionType = (FunctionType *) function.type;
     for (int i = 0; i < arguments.size(); i++) {
         auto argument = arguments[i];
         auto definedArgument = functionType->arguments[i];
-        argument->compile(program, segment);
+        compileValue(program, segment, argument, definedArgument);
         typeCast(segment.instructions,
                  deduceType(program, segment, argument)->type,
-                 definedArgument->type);
+                 definedArgument);
     }
 
     segment.instructions.push_back(
@@ -463,19 +975,17 @@ bool IfStatement::operator==(const AbstractSyntaxTree &other) const {
 void IfStatement::compile(Program &program, Segment &segment) const {
     if (deduceType(program, segment, condition)->type != VariableType::Bool)
         throw std::runtime_error("[IfStatement::compile] Condition must be a boolean!");
-    condition->compile(program, segment);
+    std::vector<size_t> elseJumps;
+    compileBranch(program, segment, condition, false, elseJumps);
+    thenBody->compile(program, segment);
+    if (!elseBody.has_value())
+        return patchJumps(segment, elseJumps, segment.instructions.size());
     size_t jumpIndex = segment.instructions.size();
     segment.instructions.push_back(
-            Instruction{.type = Instruction::InstructionType::JumpIfFalse});
-    thenBody->compile(program, segment);
-    segment.instructions[jumpIndex].params.index = segment.instructions.size() + elseBody.has_value();
-    if (elseBody.has_value()) {
-        jumpIndex = segment.instructions.size();
-        segment.instructions.push_back(
-                Instruction{.type = Instruction::InstructionType::Jump});
-        elseBody.value()->compile(program, segment);
-        segment.instructions[jumpIndex].params.index = segment.instructions.size() + 1;
-    }
+            Instruction{.type = Instruction::InstructionType::Jump});
+    patchJumps(segment, elseJumps, segment.instructions.size());
+    elseBody.value()->compile(program, segment);
+    segment.instructions[jumpIndex].params.index = segment.instructions.size();
 }
 
 WhileStatement::WhileStatement(AbstractSyntaxTree *condition, AbstractSyntaxTree *body)
@@ -492,14 +1002,12 @@ bool WhileStatement::operator==(const AbstractSyntaxTree &other) const {
 }
 void WhileStatement::compile(Program &program, Segment &segment) const {
     size_t jumpIndex = segment.instructions.size();
-    condition->compile(program, segment);
-    size_t bodyIndex = segment.instructions.size();
-    segment.instructions.push_back(
-            Instruction{.type = Instruction::InstructionType::JumpIfFalse});
+    std::vector<size_t> exitJumps;
+    compileBranch(program, segment, condition, false, exitJumps);
     body->compile(program, segment);
     segment.instructions.push_back(
             Instruction{.type = Instruction::InstructionType::Jump, .params = {.index = jumpIndex}});
-    segment.instructions[bodyIndex].params.index = segment.instructions.size();
+    patchJumps(segment, exitJumps, segment.instructions.size());
 }
 
 UnaryExpression::UnaryExpression(AbstractSyntaxTree *expression, Token op, UnaryExpression::Side side)
@@ -510,6 +1018,21 @@ UnaryExpression::UnaryExpression(AbstractSyntaxTree *expression, Token op, Unary
 }
 
 void UnaryExpression::compile(Program &program, Segment &segment) const {
+    if (op.type == Not) {
+        requireBool(program, segment, expression);
+        expression->compile(program, segment);
+        segment.instructions.push_back({.type = Instruction::LoadI64, .params = {.i64 = 0}});
+        segment.instructions.push_back({.type = Instruction::EqualI64});
+        return;
+    }
+    if (op.type == BitNot) {
+        auto type = deduceType(program, segment, expression)->type;
+        if (type != VariableType::I64 && type != VariableType::Bool)
+            throw std::runtime_error("[UnaryExpression::compile] Bitwise operators need int operands!");
+        expression->compile(program, segment);
+        segment.instructions.push_back({.type = Instruction::BitNotI64});
+        return;
+    }
     if (expression->nodeType != AbstractSyntaxTree::Type::Node)
         throw std::runtime_error("[UnaryExpression::compile] Invalid expression varType!");
     Node *node = dynamic_cast<Node *>(expression);
@@ -557,6 +1080,7 @@ void UnaryExpression::compile(Program &program, Segment &segment) const {
         default:
             throw std::runtime_error("[UnaryExpression::compile] Invalid operator: " + op.value);
     }
+    narrowValue(segment, varType);
     emitStore(program, segment, node->token.value);
 }
 bool UnaryExpression::operator==(const AbstractSyntaxTree &other) const {
@@ -593,19 +1117,18 @@ bool ForLoop::operator==(const AbstractSyntaxTree &other) const {
            *body == *otherForLoop.body;
 }
 void ForLoop::compile(Program &program, Segment &segment) const {
-    size_t condition_index, jump_index;
+    size_t condition_index;
+    std::vector<size_t> exit_jumps;
     initialization->compile(program, segment);
     condition_index = segment.instructions.size();
-    condition->compile(program, segment);
-    jump_index = segment.instructions.size();
-    segment.instructions.push_back({Instruction::InstructionType::JumpIfFalse});
+    compileBranch(program, segment, condition, false, exit_jumps);
     body->compile(program, segment);
     step->compile(program, segment);
     segment.instructions.push_back({
             .type = Instruction::InstructionType::Jump,
             .params = {.index = condition_index},
     });
-    segment.instructions[jump_index].params = {.index = segment.instructions.size()};
+    patchJumps(segment, exit_jumps, segment.instructions.size());
 }
 
 List::List(const std::vector<AbstractSyntaxTree *> &elements)
@@ -625,11 +1148,23 @@ bool List::operator==(const AbstractSyntaxTree &other) const {
     return true;
 }
 void List::compile(Program &program, Segment &segment) const {
-    for (auto element: elements)
-        element->compile(program, segment);
+    VariableType defaultType(VariableType::I64);
+    if (elements.empty())
+        return compileAs(program, segment, &defaultType);
+    compileAs(program, segment, deduceType(program, segment, elements.front()));
+}
+void List::compileAs(Program &program, Segment &segment, VariableType *elementType) const {
+    for (auto element: elements) {
+        compileValue(program, segment, element, elementType);
+        typeCast(segment.instructions, deduceType(program, segment, element)->type, elementType->type);
+    }
+    // Packed formats also need to know their width
+    auto size = elements.size();
+    if (elementType->narrow)
+        size = ArrayObject::packShape(size, storageOf(elementType));
     segment.instructions.push_back({
-            .type = Instruction::MakeArray,
-            .params = {.index = elements.size()},
+            .type = getArrayInstruction(ArrayInstruction::MakeArray, elementType),
+            .params = {.index = size},
     });
 }
 
@@ -644,6 +1179,17 @@ bool ArrayType::operator==(const AbstractSyntaxTree &other) const {
     return *type == *otherArrayType.type;
 }
 
+MapType::MapType(AbstractSyntaxTree *keyType, AbstractSyntaxTree *valueType)
+    : keyType(keyType), valueType(valueType) {
+    nodeType = AbstractSyntaxTree::Type::MapType;
+    typeStr = "MapType";
+}
+bool MapType::operator==(const AbstractSyntaxTree &other) const {
+    if (other.nodeType != nodeType) return false;
+    auto &otherMapType = dynamic_cast<const MapType &>(other);
+    return *keyType == *otherMapType.keyType && *valueType == *otherMapType.valueType;
+}
+
 ArrayAccess::ArrayAccess(Node identifier, AbstractSyntaxTree *index)
     : identifier(std::move(identifier)), index(index) {
     nodeType = AbstractSyntaxTree::Type::ArrayAccess;
@@ -656,21 +1202,175 @@ bool ArrayAccess::operator==(const AbstractSyntaxTree &other) const {
            *index == *otherArrayAccess.index;
 }
 void ArrayAccess::compile(Program &program, Segment &segment) const {
-    bool isLocal;
-    if (segment.find_local(identifier.token.value) != -1)
-        isLocal = true;
-    else if (program.find_global(identifier.token.value) != -1)
-        isLocal = false;
-    else
-        throw std::runtime_error("[ArrayAccess::compile] Identifier not found: " + identifier.token.value);
-    auto varIndex = isLocal ? segment.find_local(identifier.token.value) : program.find_global(identifier.token.value);
+    if (auto mapType = findMapType(program, segment, identifier.token.value)) {
+        compileMapKey(program, segment, *this, mapType, false);
+        segment.instructions.push_back({
+                .type = Instruction::MapGet,
+                .params = {.index = MapObject::packTypes(mapType->keyType->type, mapType->valueType->type)},
+        });
+        return;
+    }
+    if (findSoaType(program, segment, identifier.token.value) != nullptr) {
+        compileSoaIndex(program, segment, *this);
+        segment.instructions.push_back({.type = Instruction::LoadSoaRecord});
+        return;
+    }
+    auto type = deduceType(program, segment, (AbstractSyntaxTree *) &identifier)->type;
+    if (type == VariableType::Object || type == VariableType::CompressedArray) {
+        emitLoad(program, segment, identifier.token.value);
+        index->compile(program, segment);
+        typeCast(segment.instructions, deduceType(program, segment, index)->type, VariableType::I64);
+        segment.instructions.push_back({.type = type == VariableType::Object ? Instruction::LoadStringChar
+                                                                             : Instruction::LoadCompressedElement});
+        return;
+    }
     index->compile(program, segment);
+    segment.instructions.push_back(arrayElementInstruction(program, segment, identifier.token.value, false));
+}
+
+StructDeclaration::StructDeclaration(const std::vector<Declaration *> &fields)
+    : fields(fields) {
+    nodeType = Type::StructDeclaration;
+    typeStr = "StructDeclaration";
+}
+bool StructDeclaration::operator==(const AbstractSyntaxTree &other) const {
+    if (other.nodeType != nodeType) return false;
+    auto &otherStructDeclaration = dynamic_cast<const StructDeclaration &>(other);
+    if (fields.size() != otherStructDeclaration.fields.size()) return false;
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (*fields[i] != *otherStructDeclaration.fields[i])
+            return false;
+    }
+    return true;
+}
+
+FieldAccess::FieldAccess(AbstractSyntaxTree *object, Node field)
+    : object(object), field(std::move(field)) {
+    nodeType = Type::FieldAccess;
+    typeStr = "FieldAccess";
+}
+bool FieldAccess::operator==(const AbstractSyntaxTree &other) const {
+    if (other.nodeType != nodeType) return false;
+    auto &otherFieldAccess = dynamic_cast<const FieldAccess &>(other);
+    return *object == *otherFieldAccess.object && field == otherFieldAccess.field;
+}
+void FieldAccess::compile(Program &program, Segment &segment) const {
+    auto &field = findField(program, segment, *this);
+    if (isSoaElement(program, segment, object)) {
+        compileSoaIndex(program, segment, *dynamic_cast<ArrayAccess *>(object));
+        segment.instructions.push_back({
+                .type = MapObject::isObjectType(field.type->type) ? Instruction::LoadSoaObjectField : Instruction::LoadSoaField,
+                .params = {.index = StructObject::packField(field.slot, field.type->type)},
+        });
+        return;
+    }
+    object->compile(program, segment);
+    if (deduceType(program, segment, object)->type == VariableType::Soa)
+        return segment.instructions.push_back({.type = Instruction::LoadSoaColumn, .params = {.index = field.slot}});
+    segment.instructions.push_back({
+            .type = MapObject::isObjectType(field.type->type) ? Instruction::LoadObjectField : Instruction::LoadField,
+            .params = {.index = StructObject::packField(field.slot, field.type->type)},
+    });
+}
+
+MatrixType::MatrixType(AbstractSyntaxTree *type, AbstractSyntaxTree *rows, AbstractSyntaxTree *cols)
+    : type(type), rows(rows), cols(cols) {
+    nodeType = AbstractSyntaxTree::Type::MatrixType;
+    typeStr = "MatrixType";
+}
+bool MatrixType::operator==(const AbstractSyntaxTree &other) const {
+    if (other.nodeType != nodeType) return false;
+    auto &otherMatrixType = dynamic_cast<const MatrixType &>(other);
+    if ((rows == nullptr) != (otherMatrixType.rows == nullptr)) return false;
+    return *type == *otherMatrixType.type &&
+           (rows == nullptr || (*rows == *otherMatrixType.rows && *cols == *otherMatrixType.cols));
+}
+
+SoaType::SoaType(Node record)
+    : record(std::move(record)) {
+    nodeType = AbstractSyntaxTree::Type::SoaType;
+    typeStr = "SoaType";
+}
+bool SoaType::operator==(const AbstractSyntaxTree &other) const {
+    if (other.nodeType != nodeType) return false;
+    return record == dynamic_cast<const SoaType &>(other).record;
+}
+
+MatrixAccess::MatrixAccess(Node identifier, AbstractSyntaxTree *row, AbstractSyntaxTree *col)
+    : identifier(std::move(identifier)), row(row), col(col) {
+    nodeType = AbstractSyntaxTree::Type::MatrixAccess;
+    typeStr = "MatrixAccess";
+}
+bool MatrixAccess::operator==(const AbstractSyntaxTree &other) const {
+    if (other.nodeType != nodeType) return false;
+    auto &otherMatrixAccess = dynamic_cast<const MatrixAccess &>(other);
+    return identifier == otherMatrixAccess.identifier &&
+           *row == *otherMatrixAccess.row &&
+           *col == *otherMatrixAccess.col;
+}
+void MatrixAccess::compile(Program &program, Segment &segment) const {
+    auto matrixType = findMatrixType(program, segment, identifier.token.value);
+    compileMatrixIndex(program, segment, *this);
     segment.instructions.push_back({
-            .type = isLocal ? Instruction::LoadFromLocalArray : Instruction::LoadFromGlobalArray,
-            .params = {.index = varIndex},
+            .type = Instruction::LoadMatrixElement,
+            .params = {.index = matrixType->elementType->type},
     });
 }
 
+ArraySlice::ArraySlice(Node identifier, AbstractSyntaxTree *begin, AbstractSyntaxTree *end)
+    : identifier(std::move(identifier)), begin(begin), end(end) {
+    nodeType = AbstractSyntaxTree::Type::ArraySlice;
+    typeStr = "ArraySlice";
+}
+bool ArraySlice::operator==(const AbstractSyntaxTree &other) const {
+    if (other.nodeType != nodeType) return false;
+    auto &otherArraySlice = dynamic_cast<const ArraySlice &>(other);
+    return identifier == otherArraySlice.identifier &&
+           *begin == *otherArraySlice.begin &&
+           *end == *otherArraySlice.end;
+}
+void ArraySlice::compile(Program &program, Segment &segment) const {
+    emitLoad(program, segment, identifier.token.value);
+    begin->compile(program, segment);
+    typeCast(segment.instructions, deduceType(program, segment, begin)->type, VariableType::I64);
+    end->compile(program, segment);
+    typeCast(segment.instructions, deduceType(program, segment, end)->type, VariableType::I64);
+    segment.instructions.push_back({.type = Instruction::SliceArray});
+}
+
+static const std::string &exportedName(const AbstractSyntaxTree *stm) {
+    return dynamic_cast<const Declaration *>(dynamic_cast<const ExportStatement *>(stm)->stm)->identifier.token.value;
+}
+static void compileReferencedExports(Program &program, Segment &segment) {
+    if (program.pendingExports.empty()) return;
+    std::unordered_map<std::string, size_t> exports;
+    for (size_t i = 0; i < program.pendingExports.size(); i++)
+        exports[exportedName(program.pendingExports[i])] = i;
+
+    std::vector<bool> reachable(program.pendingExports.size());
+    std::unordered_set<std::string> visited = program.references;
+    std::vector<std::string> worklist(visited.begin(), visited.end());
+    while (!worklist.empty()) {
+        auto it = exports.find(worklist.back());
+        worklist.pop_back();
+        if (it == exports.end() || reachable[it->second]) continue;
+        reachable[it->second] = true;
+        std::unordered_set<std::string> dependencies;
+        collectIdentifiers(program.pendingExports[it->second], dependencies);
+        for (auto &dependency: dependencies) {
+            if (visited.insert(dependency).second)
+                worklist.push_back(dependency);
+        }
+    }
+
+    std::vector<const AbstractSyntaxTree *> selected, remaining;
+    for (size_t i = 0; i < program.pendingExports.size(); i++)
+        (reachable[i] ? selected : remaining).push_back(program.pendingExports[i]);
+    program.pendingExports = remaining;
+    for (auto stm: selected)
+        stm->compile(program, segment);
+}
+
 ImportStatement::ImportStatement(std::string path)
     : path(std::move(path)) {
     nodeType = AbstractSyntaxTree::Type::ImportStatement;
@@ -690,10 +1390,11 @@ void ImportStatement::compile(Program &program, Segment &segment) const {
     fileContent << importedFile.rdbuf();
     auto statements = parse(fileContent.str().c_str());
     for (auto stm: statements) {
+        program.trees.emplace_back(stm);
         if (stm->nodeType == AbstractSyntaxTree::Type::ExportStatement)
-            stm->compile(program, segment);
-        delete stm;
+            program.pendingExports.push_back(stm);
     }
+    compileReferencedExports(program, segment);
 }
 
 ExportStatement::ExportStatement(AbstractSyntaxTree *stm)
@@ -734,13 +1435,12 @@ void TernaryExpression::compile(Program &program, Segment &segment) const {
            "[TernaryExpression::compile] Then and else cases must have the same type!");
     assert(deduceType(program, segment, thenCase)->type != VariableType::Void,
            "[TernaryExpression::compile] Then and else cases must not be void!");
-    condition->compile(program, segment);
-    size_t jumpIndex = segment.instructions.size();
-    segment.instructions.push_back(Instruction{.type = Instruction::InstructionType::JumpIfFalse});
+    std::vector<size_t> elseJumps;
+    compileBranch(program, segment, condition, false, elseJumps);
     thenCase->compile(program, segment);
     size_t jumpIndex2 = segment.instructions.size();
     segment.instructions.push_back(Instruction{.type = Instruction::InstructionType::Jump});
-    segment.instructions[jumpIndex].params.index = segment.instructions.size();
+    patchJumps(segment, elseJumps, segment.instructions.size());
     elseCase->compile(program, segment);
     segment.instructions[jumpIndex2].params.index = segment.instructions.size();
 }
@@ -752,10 +1452,14 @@ void compile(Program &program, const char *input) {
         program.segments.front().instructions.back().type == Instruction::Exit) {
         program.segments.front().instructions.pop_back();
     }
+    program.references.clear();
     for (auto &node: ast) {
-        node->compile(program, program.segments[0]);
-        delete node;
+        program.trees.emplace_back(node);
+        collectIdentifiers(node, program.references);
     }
+    compileReferencedExports(program, program.segments[0]);
+    for (auto &node: ast)
+        node->compile(program, program.segments[0]);
     program.segments.front().instructions.push_back(
             Instruction{
                     .type = Instruction::InstructionType::Exit,
@@ -0,0 +1,111 @@
+#include "kernels.h"
+#include "vm.h"
+
+static_assert(CompressedArrayObject::blockValues == packedBlockValues);
+
+// A partial last block is padded by repeating its last element, which costs
+// no extra bits under either encoding.
+
+std::vector<CompressedArrayObject::Block> CompressedArrayObject::plan(const uint64_t *values, size_t size) {
+    std::vector<Block> blocks;
+    size_t offset = 0;
+    for (size_t begin = 0; begin < size; begin += blockValues) {
+        auto end = std::min(begin + blockValues, size);
+        auto min = (int64_t) values[begin], max = min;
+        uint64_t maxDelta = 0;
+        bool sorted = true;
+        for (size_t i = begin + 1; i < end; i++) {
+            auto value = (int64_t) values[i];
+            min = std::min(min, value);
+            max = std::max(max, value);
+            if (value < (int64_t) values[i - 1])
+                sorted = false;
+            else
+                maxDelta = std::max(maxDelta, values[i] - values[i - 1]);
+        }
+        Block block{(uint64_t) min, offset, (uint8_t) std::bit_width((uint64_t) max - (uint64_t) min), false};
+        auto deltaWidth = (uint8_t) std::bit_width(maxDelta);
+        if (sorted && deltaWidth < block.width)
+            block = {values[begin], offset, deltaWidth, true};
+        offset += packedWords(block.width);
+        blocks.push_back(block);
+    }
+    return blocks;
+}
+
+CompressedArrayObject::CompressedArrayObject(const uint64_t *values, size_t size, const std::vector<Block> &plan)
+    : Object(Object::Type::CompressedArray), size(size), blockCount(plan.size()), words(totalWords(plan)) {
+    std::copy(plan.begin(), plan.end(), blocks());
+    uint64_t offsets[blockValues];
+    for (size_t index = 0; index < blockCount; index++) {
+        auto &block = blocks()[index];
+        auto first = values + index * blockValues;
+        auto count = std::min(blockValues, size - index * blockValues);
+        for (size_t i = 0; i < blockValues; i++) {
+            if (block.delta)
+                offsets[i] = i == 0 || i >= count ? 0 : first[i] - first[i - 1];
+            else
+                offsets[i] = first[std::min(i, count - 1)] - block.base;
+        }
+        packBlock(packed() + block.offset, offsets, block.width);
+    }
+}
+
+void CompressedArrayObject::decodeBlock(size_t index, uint64_t *destination) const {
+    auto &block = blocks()[index];
+    unpackBlock(destination, packed() + block.offset, block.width, block.delta ? 0 : block.base);
+    if (!block.delta) return;
+    auto value = block.base;
+    for (size_t i = 0; i < blockValues; i++) {
+        value += destination[i];
+        destination[i] = value;
+    }
+}
+
+void CompressedArrayObject::decode(uint64_t *destination) const {
+    uint64_t buffer[blockValues];
+    for (size_t index = 0; index < blockCount; index++) {
+        auto count = std::min(blockValues, size - index * blockValues);
+        if (count == blockValues) {
+            decodeBlock(index, destination + index * blockValues);
+        } else {
+            decodeBlock(index, buffer);
+            std::memcpy(destination + index * blockValues, buffer, count * sizeof(uint64_t));
+        }
+    }
+}
+
+uint64_t CompressedArrayObject::field(const Block &block, size_t j) const {
+    if (block.width == 0) return 0;
+    auto lane = packed() + block.offset + j % packedLanes;
+    auto bit = j / packedLanes * block.width;
+    auto word = bit / 64, shift = bit % 64;
+    auto value = lane[word * packedLanes] >> shift;
+    if (shift + block.width > 64)
+        value |= lane[(word + 1) * packedLanes] << (64 - shift);
+    return block.width == 64 ? value : value & ((uint64_t(1) << block.width) - 1);
+}
+
+// Random access reads single fields instead of unpacking the block, which
+// keeps the array immutable and free of scratch space. A delta block sums
+// the gaps up to the element.
+uint64_t CompressedArrayObject::get(size_t index) const {
+    auto &block = blocks()[index / blockValues];
+    auto j = index % blockValues;
+    if (!block.delta)
+        return block.base + field(block, j);
+    auto value = block.base;
+    for (size_t i = 1; i <= j; i++)
+        value += field(block, i);
+    return value;
+}
+
+uint64_t CompressedArrayObject::sum() const {
+    uint64_t buffer[blockValues];
+    uint64_t result = 0;
+    for (size_t index = 0; index < blockCount; index++) {
+        decodeBlock(index, buffer);
+        result += arraySumI64(buffer, std::min(blockValues, size - index * blockValues));
+    }
+    return result;
+}
@@ -0,0 +1,407 @@
+#include "vm.h"
+#include <algorithm>
+#include <stdexcept>
+
+// Generational collection: new objects start in the nursery and are promoted
+// to the tenured generation once they survive a minor collection. Objects are
+// never moved, promotion only changes which list owns them.
+//
+// Minor collections only scan the operand stack, the stack frames written to
+// since the last collection and the remembered set: a clean frame can only
+// reference objects that were already promoted when it was last scanned.
+// Major cycles in turn treat references out of the nursery as roots.
+//
+// The tenured generation is collected incrementally with tri-color marking
+// (white: unmarked, gray: marked and on grayStack, black: marked and scanned).
+// Each step does as much marking or sweeping as fits in gcPauseBudget, and
+// steps run after every minor collection and every gcStepInterval dispatched
+// instructions. The write barrier re-grays mutated black objects, and roots
+// are scanned again atomically before sweeping starts.
+//
+// Collections are paced by bytes, payloads included: a minor collection runs
+// once gcNurserySize bytes were allocated in the nursery, and a major cycle
+// starts when the tenured generation outgrows the heap that survived the
+// previous cycle by gcGrowthFactor, but never below gcMinHeap.
+//
+// Stop-the-world marking (minor collections and the final step of a major
+// mark phase) goes through the ParallelMarker, which spreads large root sets
+// over gcMarkThreads threads. Mark bits are atomic for that reason.
+//
+// Dead objects are not destroyed inline: both collectors unlink them from
+// their generation list and pass them to the BackgroundSweeper, which runs
+// the destructors and releases the memory on its own thread. Mark bits of
+// survivors are reset by the mutator while unlinking, so the helper thread
+// never touches a live object.
+//
+// Objects created by the VM itself live in its size-class Allocator, so the
+// sweeper returns their blocks through the allocator's concurrent free path.
+// Everything else was placed in a malloc'ed block by makeObject().
+
+static size_t objectSize(const Object *obj) {
+    switch (obj->objType) {
+        case Object::Type::String:
+            return StringObject::blockSize(static_cast<const StringObject *>(obj)->capacity);
+        case Object::Type::Array: {
+            auto array = static_cast<const ArrayObject *>(obj);
+            auto size = ArrayObject::blockSize(array->elementType, array->inlineCapacity);
+            if (array->ownsExternalStorage())
+                size += ArrayObject::storageBytes(array->elementType, array->capacity);
+            return size;
+        }
+        case Object::Type::Map:
+            return sizeof(MapObject) + MapObject::storageBytes(static_cast<const MapObject *>(obj)->capacity);
+        case Object::Type::Matrix: {
+            auto matrix = static_cast<const MatrixObject *>(obj);
+            return MatrixObject::blockSize(matrix->rows, matrix->cols);
+        }
+        case Object::Type::Struct:
+            return StructObject::blockSize(static_cast<const StructObject *>(obj)->fieldCount);
+        case Object::Type::Soa:
+            return SoaObject::blockSize(static_cast<const SoaObject *>(obj)->fieldCount);
+        case Object::Type::CompressedArray: {
+            auto compressed = static_cast<const CompressedArrayObject *>(obj);
+            return CompressedArrayObject::blockSize(compressed->blockCount, compressed->words);
+        }
+        case Object::Type::DynamicLib:
+            return sizeof(DynamicLibObject);
+        case Object::Type::DynamicFunction:
+            return sizeof(DynamicFunctionObject);
+        default:
+            return sizeof(Object);
+    }
+}
+
+void destroyObject(Object *obj, Allocator &allocator, bool concurrent) {
+    auto release = [&](void *ptr, size_t size) {
+        if (!obj->pooled)
+            free(ptr);
+        else if (concurrent)
+            allocator.deallocateConcurrent(ptr, size);
+        else
+            allocator.deallocate(ptr, size);
+    };
+    size_t size;
+    switch (obj->objType) {
+        case Object::Type::String:
+            size = StringObject::blockSize(static_cast<StringObject *>(obj)->capacity);
+            break;
+        case Object::Type::Array: {
+            auto array = static_cast<ArrayObject *>(obj);
+            if (array->ownsExternalStorage())
+                release(array->data, ArrayObject::storageBytes(array->elementType, array->capacity));
+            size = ArrayObject::blockSize(array->elementType, array->inlineCapacity);
+        } break;
+        case Object::Type::Map: {
+            auto map = static_cast<MapObject *>(obj);
+            if (map->control != nullptr)
+                release(map->control, MapObject::storageBytes(map->capacity));
+            size = sizeof(MapObject);
+        } break;
+        case Object::Type::Matrix: {
+            auto matrix = static_cast<MatrixObject *>(obj);
+            size = MatrixObject::blockSize(matrix->rows, matrix->cols);
+        } break;
+        case Object::Type::Struct:
+            size = StructObject::blockSize(static_cast<StructObject *>(obj)->fieldCount);
+            break;
+        case Object::Type::Soa:
+            size = SoaObject::blockSize(static_cast<SoaObject *>(obj)->fieldCount);
+            break;
+        case Object::Type::CompressedArray: {
+            auto compressed = static_cast<CompressedArrayObject *>(obj);
+            size = CompressedArrayObject::blockSize(compressed->blockCount, compressed->words);
+        } break;
+        case Object::Type::DynamicLib:
+            dlclose(static_cast<DynamicLibObject *>(obj)->handle);
+            size = sizeof(DynamicLibObject);
+            break;
+        case Object::Type::DynamicFunction:
+            static_cast<DynamicFunctionObject *>(obj)->~DynamicFunctionObject();
+            size = sizeof(DynamicFunctionObject);
+            break;
+        default:
+            throw std::runtime_error("[destroyObject] Unknown object type");
+    }
+    release(obj, size);
+}
+
+void VM::addObject(Object *obj, bool collect) {
+    nursery.push_back(obj);
+    nurseryBytes += objectSize(obj);
+    if (collect && nurseryBytes > gcNurserySize)
+        minorCollection();
+}
+void VM::accountGrowth(Object *obj, ptrdiff_t bytes) {
+    if (obj->tenured)
+        tenuredBytes += bytes;
+    else
+        nurseryBytes += bytes;
+}
+size_t VM::heapSize() const {
+    return nurseryBytes + tenuredBytes;
+}
+bool VM::shouldStartMajorCycle() const {
+    auto threshold = static_cast<size_t>(static_cast<double>(liveBytes) * (1.0 + gcGrowthFactor));
+    return gcPhase == GCPhase::Idle && tenuredBytes > std::max(gcMinHeap, threshold);
+}
+void VM::writeBarrier(Object *obj) {
+    if (!obj->tenured) return;
+    if (!obj->remembered) {
+        obj->remembered = true;
+        rememberedSet.push_back(obj);
+    }
+    if (gcPhase == GCPhase::Mark && obj->isMarked())
+        grayStack.push_back(obj);
+}
+void VM::shade(Object *obj) {
+    if (obj == nullptr || !obj->tenured || obj->isMarked()) return;
+    obj->setMarked(true);
+    grayStack.push_back(obj);
+}
+void VM::collectRoots(bool minor) {
+    roots.clear();
+    auto add = [this, minor](Object *obj) {
+        if (obj != nullptr && obj->tenured != minor)
+            roots.push_back(obj);
+    };
+    for (size_t i = 0; i < pointersStackSize; i++)
+        add(pointersStack[i]);
+    for (auto &stackFrame: callStack) {
+        if (minor) {
+            if (!stackFrame.dirty) continue;
+            stackFrame.dirty = false;
+        }
+        for (size_t i = 0; i < stackFrame.localPointersSize; i++)
+            add(stackFrame.localPointers[i]);
+    }
+    // Young objects may be the only holders of a tenured one
+    if (!minor) {
+        for (auto obj: nursery)
+            forEachReference(obj, add);
+        return;
+    }
+    for (auto obj: rememberedSet) {
+        forEachReference(obj, add);
+        obj->remembered = false;
+    }
+    rememberedSet.clear();
+}
+void VM::markFromRoots(bool tenuredGeneration) {
+    marker.mark(roots, tenuredGeneration, gcMarkThreads, gcParallelMarkThreshold);
+    roots.clear();
+}
+void VM::promoteSurvivors() {
+    for (auto obj: nursery) {
+        if (obj->isMarked()) {
+            obj->setMarked(false);
+            obj->tenured = true;
+            tenured.push_back(obj);
+            tenuredBytes += objectSize(obj);
+            // Objects promoted during a major cycle must not be swept by it
+            if (gcPhase == GCPhase::Mark)
+                shade(obj);
+            else if (gcPhase == GCPhase::Sweep)
+                obj->setMarked(true);
+        } else {
+            deadObjects.push_back(obj);
+        }
+    }
+    nursery.clear();
+    nurseryBytes = 0;
+    sweeper.release(deadObjects);
+}
+void VM::minorCollection() {
+    collectRoots(true);
+    markFromRoots(false);
+    promoteSurvivors();
+    if (shouldStartMajorCycle())
+        startMajorCycle();
+    if (gcPhase != GCPhase::Idle)
+        majorStep();
+}
+void VM::startMajorCycle() {
+    gcPhase = GCPhase::Mark;
+    collectRoots(false);
+    for (auto obj: roots)
+        shade(obj);
+    roots.clear();
+}
+void VM::finishMarking() {
+    collectRoots(false);
+    roots.insert(roots.end(), grayStack.begin(), grayStack.end());
+    grayStack.clear();
+    markFromRoots(true);
+    gcPhase = GCPhase::Sweep;
+    sweepRead = 0;
+    sweepWrite = 0;
+}
+void VM::majorStep() {
+    const size_t batchSize = 64;
+    auto deadline = std::chrono::steady_clock::now() + gcPauseBudget;
+    do {
+        if (gcPhase == GCPhase::Mark) {
+            for (size_t i = 0; i < batchSize && !grayStack.empty(); i++) {
+                auto obj = grayStack.back();
+                grayStack.pop_back();
+                forEachReference(obj, [this](Object *child) { shade(child); });
+            }
+            if (grayStack.empty())
+                finishMarking();
+        } else if (gcPhase == GCPhase::Sweep) {
+            for (size_t i = 0; i < batchSize && sweepRead < tenured.size(); i++) {
+                auto obj = tenured[sweepRead++];
+                if (!obj->isMarked()) {
+                    tenuredBytes -= objectSize(obj);
+                    deadObjects.push_back(obj);
+                } else {
+                    obj->setMarked(false);
+                    tenured[sweepWrite++] = obj;
+                }
+            }
+            if (sweepRead == tenured.size()) {
+                tenured.resize(sweepWrite);
+                liveBytes = tenuredBytes;
+                gcPhase = GCPhase::Idle;
+            }
+        }
+    } while (gcPhase != GCPhase::Idle && std::chrono::steady_clock::now() < deadline);
+    sweeper.release(deadObjects);
+}
+
+BackgroundSweeper::~BackgroundSweeper() {
+    if (!worker.joinable()) return;
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    wakeUp.notify_one();
+    worker.join();
+}
+void BackgroundSweeper::release(std::vector<Object *> &objects) {
+    if (objects.empty()) return;
+    {
+        std::lock_guard lock(mutex);
+        pending.insert(pending.end(), objects.begin(), objects.end());
+        if (!worker.joinable())
+            worker = std::thread(&BackgroundSweeper::loop, this);
+    }
+    objects.clear();
+    wakeUp.notify_one();
+}
+void BackgroundSweeper::loop() {
+    std::vector<Object *> batch;
+    for (;;) {
+        {
+            std::unique_lock lock(mutex);
+            wakeUp.wait(lock, [this] { return stopping || !pending.empty(); });
+            if (pending.empty()) return;
+            batch.swap(pending);
+        }
+        for (auto obj: batch)
+            destroyObject(obj, allocator, true);
+        batch.clear();
+    }
+}
+
+bool ParallelMarker::inGeneration(const Object *obj) const {
+    return obj != nullptr && obj->tenured == tenuredGeneration;
+}
+void ParallelMarker::mark(const std::vector<Object *> &roots, bool tenured, size_t threads, size_t parallelThreshold) {
+    tenuredGeneration = tenured;
+    threads = std::min(threads, roots.size() / std::max<size_t>(parallelThreshold, 1));
+    if (threads <= 1)
+        return markSequential(roots);
+
+    while (stacks.size() < threads)
+        stacks.push_back(std::make_unique<MarkStack>());
+    stacks.resize(threads);
+    idleWorkers = 0;
+    std::vector<std::thread> workers;
+    auto chunk = (roots.size() + threads - 1) / threads;
+    for (size_t id = 1; id < threads; id++) {
+        auto begin = std::min(id * chunk, roots.size());
+        auto count = std::min(chunk, roots.size() - begin);
+        workers.emplace_back(&ParallelMarker::work, this, id, roots.data() + begin, count);
+    }
+    work(0, roots.data(), std::min(chunk, roots.size()));
+    for (auto &worker: workers)
+        worker.join();
+}
+void ParallelMarker::markSequential(const std::vector<Object *> &roots) {
+    std::vector<Object *> pending;
+    for (auto root: roots) {
+        if (!inGeneration(root)) continue;
+        root->setMarked(true);
+        pending.push_back(root);
+        while (!pending.empty()) {
+            auto obj = pending.back();
+            pending.pop_back();
+            forEachReference(obj, [this, &pending](Object *child) {
+                if (inGeneration(child) && child->tryMark())
+                    pending.push_back(child);
+            });
+        }
+    }
+}
+void ParallelMarker::work(size_t id, Object *const *roots, size_t count) {
+    auto &stack = *stacks[id];
+    for (size_t i = 0; i < count; i++) {
+        if (!inGeneration(roots[i])) continue;
+        roots[i]->tryMark();
+        std::lock_guard lock(stack.mutex);
+        stack.objects.push_back(roots[i]);
+    }
+    for (;;) {
+        Object *obj;
+        if (pop(id, obj) || (steal(id) && pop(id, obj))) {
+            forEachReference(obj, [this, &stack](Object *child) {
+                if (!inGeneration(child) || !child->tryMark()) return;
+                std::lock_guard lock(stack.mutex);
+                stack.objects.push_back(child);
+            });
+            continue;
+        }
+        // Out of work: wait until every worker is idle or someone has
+        // something left to steal.
+        idleWorkers++;
+        for (;;) {
+            if (idleWorkers == stacks.size()) return;
+            if (hasWork()) break;
+            std::this_thread::yield();
+        }
+        idleWorkers--;
+    }
+}
+bool ParallelMarker::pop(size_t id, Object *&obj) {
+    auto &stack = *stacks[id];
+    std::lock_guard lock(stack.mutex);
+    if (stack.objects.empty()) return false;
+    obj = stack.objects.back();
+    stack.objects.pop_back();
+    return true;
+}
+bool ParallelMarker::steal(size_t id) {
+    for (size_t offset = 1; offset < stacks.size(); offset++) {
+        auto &victim = *stacks[(id + offset) % stacks.size()];
+        std::vector<Object *> stolen;
+        {
+            std::lock_guard lock(victim.mutex);
+            if (victim.objects.empty()) continue;
+            auto half = victim.objects.begin() + (victim.objects.size() + 1) / 2;
+            stolen.assign(victim.objects.begin(), half);
+            victim.objects.erase(victim.objects.begin(), half);
+        }
+        auto &stack = *stacks[id];
+        std::lock_guard lock(stack.mutex);
+        stack.objects.insert(stack.objects.end(), stolen.begin(), stolen.end());
+        return true;
+    }
+    return false;
+}
+bool ParallelMarker::hasWork() {
+    for (auto &stack: stacks) {
+        std::lock_guard lock(stack->mutex);
+        if (!stack->objects.empty()) return true;
+    }
+    return false;
+}
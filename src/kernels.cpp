@@ -0,0 +1,339 @@
+#include "kernels.h"
+#include <algorithm>
+#include <cstring>
+
+// Every kernel is written once against GCC vector extensions and compiled
+// for several targets: on x86-64 an AVX2 variant and a baseline SSE2 variant
+// are emitted and the first call site picks one for the running CPU. Other
+// architectures get the same code lowered to their native vectors or to
+// scalar operations. Dispatch is explicit rather than through ifuncs, which
+// are unavailable on some libcs and break under ThreadSanitizer.
+#define INLINE inline __attribute__((always_inline))
+#if defined(__x86_64__) && defined(__GNUC__)
+static const bool hasAVX2 = __builtin_cpu_supports("avx2");
+#define KERNEL(RETURN, NAME, PARAMETERS, ARGUMENTS, BODY)                  \
+    __attribute__((target("avx2"))) static RETURN NAME##AVX2 PARAMETERS { \
+        return BODY;                                                      \
+    }                                                                     \
+    static RETURN NAME##Baseline PARAMETERS {                             \
+        return BODY;                                                      \
+    }                                                                     \
+    RETURN NAME PARAMETERS {                                              \
+        return hasAVX2 ? NAME##AVX2 ARGUMENTS : NAME##Baseline ARGUMENTS;  \
+    }
+#else
+#define KERNEL(RETURN, NAME, PARAMETERS, ARGUMENTS, BODY) \
+    RETURN NAME PARAMETERS {                              \
+        return BODY;                                      \
+    }
+#endif
+
+// load returns 32-byte vectors, which GCC flags as an ABI change for the
+// baseline target. Every helper is always_inline, so no vector crosses a
+// call boundary and the difference is never observable.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpsabi"
+namespace {
+    constexpr size_t lanes = 4;
+    typedef uint64_t U64Vector __attribute__((vector_size(lanes * sizeof(uint64_t))));
+    typedef int64_t I64Vector __attribute__((vector_size(lanes * sizeof(int64_t))));
+    typedef double F64Vector __attribute__((vector_size(lanes * sizeof(double))));
+    constexpr size_t byteLanes = 32;
+    typedef uint8_t ByteVector __attribute__((vector_size(byteLanes)));
+
+    // Array storage is a buffer of 64-bit words, memcpy keeps the
+    // reinterpretation free of aliasing issues and compiles to plain moves
+    template<typename T>
+    INLINE T load(const uint64_t *ptr) {
+        T value;
+        memcpy(&value, ptr, sizeof(T));
+        return value;
+    }
+    template<typename T>
+    INLINE void store(uint64_t *ptr, const T &value) {
+        memcpy(ptr, &value, sizeof(T));
+    }
+
+    template<typename T, typename V>
+    INLINE T sum(const uint64_t *data, size_t size) {
+        V first = {}, second = {};
+        size_t i = 0;
+        for (; i + 2 * lanes <= size; i += 2 * lanes) {
+            first += load<V>(data + i);
+            second += load<V>(data + i + lanes);
+        }
+        first += second;
+        T result = 0;
+        for (size_t lane = 0; lane < lanes; lane++)
+            result += first[lane];
+        for (; i < size; i++)
+            result += load<T>(data + i);
+        return result;
+    }
+
+    template<typename T, typename V, bool minimum>
+    INLINE T extreme(const uint64_t *data, size_t size) {
+        T result = load<T>(data);
+        size_t i = 0;
+        if (size >= lanes) {
+            auto best = load<V>(data);
+            for (i = lanes; i + lanes <= size; i += lanes) {
+                auto value = load<V>(data + i);
+                best = minimum ? (value < best ? value : best) : (value > best ? value : best);
+            }
+            result = best[0];
+            for (size_t lane = 1; lane < lanes; lane++)
+                result = minimum ? (best[lane] < result ? best[lane] : result) : (best[lane] > result ? best[lane] : result);
+        }
+        for (; i < size; i++) {
+            auto value = load<T>(data + i);
+            result = minimum ? (value < result ? value : result) : (value > result ? value : result);
+        }
+        return result;
+    }
+
+    template<typename T, typename V>
+    INLINE T dot(const uint64_t *left, const uint64_t *right, size_t size) {
+        V first = {}, second = {};
+        size_t i = 0;
+        for (; i + 2 * lanes <= size; i += 2 * lanes) {
+            first += load<V>(left + i) * load<V>(right + i);
+            second += load<V>(left + i + lanes) * load<V>(right + i + lanes);
+        }
+        first += second;
+        T result = 0;
+        for (size_t lane = 0; lane < lanes; lane++)
+            result += first[lane];
+        for (; i < size; i++)
+            result += load<T>(left + i) * load<T>(right + i);
+        return result;
+    }
+
+    template<typename T, typename V>
+    INLINE void scale(uint64_t *data, size_t size, T factor) {
+        size_t i = 0;
+        for (; i + lanes <= size; i += lanes)
+            store(data + i, load<V>(data + i) * factor);
+        for (; i < size; i++)
+            store(data + i, load<T>(data + i) * factor);
+    }
+
+    template<typename T, typename V>
+    INLINE void add(uint64_t *destination, const uint64_t *source, size_t size) {
+        size_t i = 0;
+        for (; i + lanes <= size; i += lanes)
+            store(destination + i, load<V>(destination + i) + load<V>(source + i));
+        for (; i < size; i++)
+            store(destination + i, load<T>(destination + i) + load<T>(source + i));
+    }
+
+    template<typename T, typename V>
+    INLINE size_t countEqual(const uint64_t *data, size_t size, T value) {
+        // Lane-wise comparisons yield -1 for matches
+        I64Vector matches = {};
+        size_t i = 0;
+        for (; i + lanes <= size; i += lanes)
+            matches -= load<V>(data + i) == value;
+        size_t result = 0;
+        for (size_t lane = 0; lane < lanes; lane++)
+            result += matches[lane];
+        for (; i < size; i++)
+            result += load<T>(data + i) == value;
+        return result;
+    }
+
+    // Substring search with a first/last byte filter: a block of candidate
+    // positions is compared against the needle's first and last bytes at
+    // once, and only positions where both match are verified with memcmp.
+    // A one-byte needle degenerates into a memchr-style scan.
+    INLINE size_t find(const char *haystack, size_t length, const char *needle, size_t needleLength) {
+        if (needleLength == 0) return 0;
+        if (needleLength > length) return stringNotFound;
+        auto first = ByteVector{} + (uint8_t) needle[0];
+        auto last = ByteVector{} + (uint8_t) needle[needleLength - 1];
+        auto matches = [&](size_t i) {
+            return needleLength <= 2 || memcmp(haystack + i + 1, needle + 1, needleLength - 2) == 0;
+        };
+        auto candidates = length - needleLength + 1;
+        size_t i = 0;
+        for (; i + byteLanes <= candidates; i += byteLanes) {
+            ByteVector head, tail;
+            memcpy(&head, haystack + i, sizeof(ByteVector));
+            memcpy(&tail, haystack + i + needleLength - 1, sizeof(ByteVector));
+            auto mask = (head == first) & (tail == last);
+            auto words = load<U64Vector>(reinterpret_cast<const uint64_t *>(&mask));
+            if ((words[0] | words[1] | words[2] | words[3]) == 0)
+                continue;
+            for (size_t j = 0; j < byteLanes; j++) {
+                if (mask[j] != 0 && matches(i + j))
+                    return i + j;
+            }
+        }
+        for (; i < candidates; i++) {
+            if (haystack[i] == needle[0] && haystack[i + needleLength - 1] == needle[needleLength - 1] && matches(i))
+                return i;
+        }
+        return stringNotFound;
+    }
+
+    INLINE size_t count(const char *haystack, size_t length, const char *needle, size_t needleLength) {
+        if (needleLength == 0) return length + 1;
+        size_t result = 0;
+        for (size_t offset = 0;;) {
+            auto position = find(haystack + offset, length - offset, needle, needleLength);
+            if (position == stringNotFound)
+                return result;
+            result++;
+            offset += position + needleLength;
+        }
+    }
+
+    template<typename T, typename V>
+    INLINE void fill(uint64_t *data, size_t size, T value) {
+        V splat = V{} + value;
+        size_t i = 0;
+        for (; i + lanes <= size; i += lanes)
+            store(data + i, splat);
+        for (; i < size; i++)
+            data[i] = value;
+    }
+
+    // Blocked i-k-j product: a tile of the right operand stays in cache
+    // while every row of the left one streams past it, and the inner loop
+    // updates a row of the result lanes columns at a time
+    constexpr size_t tile = 64;
+    template<typename T, typename V>
+    INLINE void multiply(uint64_t *result, const uint64_t *left, const uint64_t *right,
+                         size_t rows, size_t inner, size_t cols) {
+        for (size_t kk = 0; kk < inner; kk += tile) {
+            auto kEnd = std::min(kk + tile, inner);
+            for (size_t jj = 0; jj < cols; jj += tile) {
+                auto jEnd = std::min(jj + tile, cols);
+                for (size_t i = 0; i < rows; i++) {
+                    auto row = result + i * cols;
+                    for (size_t k = kk; k < kEnd; k++) {
+                        auto factor = load<T>(left + i * inner + k);
+                        auto source = right + k * cols;
+                        size_t j = jj;
+                        for (; j + lanes <= jEnd; j += lanes)
+                            store(row + j, load<V>(row + j) + load<V>(source + j) * factor);
+                        for (; j < jEnd; j++)
+                            store(row + j, load<T>(row + j) + load<T>(source + j) * factor);
+                    }
+                }
+            }
+        }
+    }
+
+    INLINE void transpose(uint64_t *destination, const uint64_t *source, size_t rows, size_t cols) {
+        for (size_t ii = 0; ii < rows; ii += tile) {
+            auto iEnd = std::min(ii + tile, rows);
+            for (size_t jj = 0; jj < cols; jj += tile) {
+                auto jEnd = std::min(jj + tile, cols);
+                for (size_t i = ii; i < iEnd; i++) {
+                    for (size_t j = jj; j < jEnd; j++)
+                        destination[j * rows + i] = source[i * cols + j];
+                }
+            }
+        }
+    }
+
+    // Value j of a block is field j / lanes of lane j % lanes, and each lane
+    // is a run of width-bit fields across its words. Every row of lanes then
+    // sits at the same bit position, so a row packs and unpacks with one
+    // vector shift, plus a second one when it straddles two words.
+    static_assert(lanes == packedLanes);
+    constexpr size_t blockRows = packedBlockValues / lanes;
+    INLINE void pack(uint64_t *packed, const uint64_t *values, size_t width) {
+        if (width == 0) return;
+        U64Vector current = {};
+        size_t shift = 0;
+        for (size_t row = 0; row < blockRows; row++) {
+            auto value = load<U64Vector>(values + row * lanes);
+            current |= value << shift;
+            if (shift + width < 64) {
+                shift += width;
+                continue;
+            }
+            store(packed, current);
+            packed += lanes;
+            current = shift + width > 64 ? value >> (64 - shift) : U64Vector{};
+            shift = shift + width - 64;
+        }
+    }
+    INLINE void unpack(uint64_t *destination, const uint64_t *packed, size_t width, uint64_t base) {
+        U64Vector offset = U64Vector{} + base;
+        if (width == 0) {
+            for (size_t row = 0; row < blockRows; row++)
+                store(destination + row * lanes, offset);
+            return;
+        }
+        U64Vector mask = U64Vector{} + (width == 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1);
+        auto end = packed + width * lanes;
+        auto current = load<U64Vector>(packed);
+        size_t shift = 0;
+        for (size_t row = 0; row < blockRows; row++) {
+            auto value = current >> shift;
+            if (shift + width < 64) {
+                shift += width;
+            } else {
+                packed += lanes;
+                // The last row ends exactly on the block's last word
+                auto next = packed < end ? load<U64Vector>(packed) : U64Vector{};
+                if (shift + width > 64)
+                    value |= next << (64 - shift);
+                current = next;
+                shift = shift + width - 64;
+            }
+            store(destination + row * lanes, (value & mask) + offset);
+        }
+    }
+}// namespace
+#pragma GCC diagnostic pop
+
+KERNEL(uint64_t, arraySumI64, (const uint64_t *data, size_t size), (data, size),
+       (sum<uint64_t, U64Vector>(data, size)))
+KERNEL(double, arraySumF64, (const uint64_t *data, size_t size), (data, size),
+       (sum<double, F64Vector>(data, size)))
+KERNEL(int64_t, arrayMinI64, (const uint64_t *data, size_t size), (data, size),
+       (extreme<int64_t, I64Vector, true>(data, size)))
+KERNEL(double, arrayMinF64, (const uint64_t *data, size_t size), (data, size),
+       (extreme<double, F64Vector, true>(data, size)))
+KERNEL(int64_t, arrayMaxI64, (const uint64_t *data, size_t size), (data, size),
+       (extreme<int64_t, I64Vector, false>(data, size)))
+KERNEL(double, arrayMaxF64, (const uint64_t *data, size_t size), (data, size),
+       (extreme<double, F64Vector, false>(data, size)))
+KERNEL(uint64_t, arrayDotI64, (const uint64_t *left, const uint64_t *right, size_t size), (left, right, size),
+       (dot<uint64_t, U64Vector>(left, right, size)))
+KERNEL(double, arrayDotF64, (const uint64_t *left, const uint64_t *right, size_t size), (left, right, size),
+       (dot<double, F64Vector>(left, right, size)))
+KERNEL(void, arrayScaleI64, (uint64_t *data, size_t size, uint64_t factor), (data, size, factor),
+       (scale<uint64_t, U64Vector>(data, size, factor)))
+KERNEL(void, arrayScaleF64, (uint64_t *data, size_t size, double factor), (data, size, factor),
+       (scale<double, F64Vector>(data, size, factor)))
+KERNEL(void, arrayAddI64, (uint64_t *destination, const uint64_t *source, size_t size), (destination, source, size),
+       (add<uint64_t, U64Vector>(destination, source, size)))
+KERNEL(void, arrayAddF64, (uint64_t *destination, const uint64_t *source, size_t size), (destination, source, size),
+       (add<double, F64Vector>(destination, source, size)))
+KERNEL(void, arrayFill, (uint64_t *data, size_t size, uint64_t value), (data, size, value),
+       (fill<uint64_t, U64Vector>(data, size, value)))
+KERNEL(size_t, arrayCountEqualI64, (const uint64_t *data, size_t size, uint64_t value), (data, size, value),
+       (countEqual<int64_t, I64Vector>(data, size, (int64_t) value)))
+KERNEL(size_t, arrayCountEqualF64, (const uint64_t *data, size_t size, double value), (data, size, value),
+       (countEqual<double, F64Vector>(data, size, value)))
+KERNEL(void, matrixMultiplyI64,
+       (uint64_t *result, const uint64_t *left, const uint64_t *right, size_t rows, size_t inner, size_t cols),
+       (result, left, right, rows, inner, cols), (multiply<uint64_t, U64Vector>(result, left, right, rows, inner, cols)))
+KERNEL(void, matrixMultiplyF64,
+       (uint64_t *result, const uint64_t *left, const uint64_t *right, size_t rows, size_t inner, size_t cols),
+       (result, left, right, rows, inner, cols), (multiply<double, F64Vector>(result, left, right, rows, inner, cols)))
+KERNEL(void, matrixTranspose, (uint64_t *destination, const uint64_t *source, size_t rows, size_t cols),
+       (destination, source, rows, cols), (transpose(destination, source, rows, cols)))
+KERNEL(void, packBlock, (uint64_t *packed, const uint64_t *values, size_t width), (packed, values, width),
+       (pack(packed, values, width)))
+KERNEL(void, unpackBlock, (uint64_t *destination, const uint64_t *packed, size_t width, uint64_t base),
+       (destination, packed, width, base), (unpack(destination, packed, width, base)))
+KERNEL(size_t, stringFind, (const char *haystack, size_t length, const char *needle, size_t needleLength),
+       (haystack, length, needle, needleLength), (find(haystack, length, needle, needleLength)))
+KERNEL(size_t, stringCount, (const char *haystack, size_t length, const char *needle, size_t needleLength),
+       (haystack, length, needle, needleLength), (count(haystack, length, needle, needleLength)))
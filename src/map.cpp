@@ -0,0 +1,137 @@
+#include "vm.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Probing follows the SwissTable scheme: the upper bits of the hash pick the
+// group to start at and the low 7 bits (H2) are stored in the control byte.
+// Each probe step compares H2 against a whole group of control bytes, with
+// SSE2 when available, and only the matching slots compare their keys.
+
+namespace {
+    class Group {
+#ifdef __SSE2__
+        __m128i bytes;
+
+    public:
+        explicit Group(const uint8_t *control)
+            : bytes(_mm_loadu_si128(reinterpret_cast<const __m128i *>(control))) {}
+        [[nodiscard]] uint32_t match(uint8_t h2) const {
+            return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8((char) h2)));
+        }
+        [[nodiscard]] uint32_t matchEmpty() const {
+            return match(MapObject::empty);
+        }
+        // Empty and deleted slots are the only ones with the high bit set
+        [[nodiscard]] uint32_t matchFree() const {
+            return _mm_movemask_epi8(bytes);
+        }
+#else
+        const uint8_t *bytes;
+        template<typename Predicate>
+        [[nodiscard]] uint32_t matchIf(Predicate predicate) const {
+            uint32_t mask = 0;
+            for (size_t i = 0; i < MapObject::groupWidth; i++)
+                mask |= uint32_t(predicate(bytes[i])) << i;
+            return mask;
+        }
+
+    public:
+        explicit Group(const uint8_t *control) : bytes(control) {}
+        [[nodiscard]] uint32_t match(uint8_t h2) const {
+            return matchIf([h2](uint8_t byte) { return byte == h2; });
+        }
+        [[nodiscard]] uint32_t matchEmpty() const {
+            return match(MapObject::empty);
+        }
+        [[nodiscard]] uint32_t matchFree() const {
+            return matchIf([](uint8_t byte) { return (byte & 0x80) != 0; });
+        }
+#endif
+    };
+
+    inline uint8_t h2(uint64_t hash) {
+        return hash & 0x7F;
+    }
+    inline bool keysEqual(const MapObject *map, uint64_t left, uint64_t right) {
+        if (left == right) return true;
+        if (!map->stringKeys()) return false;
+        return *reinterpret_cast<StringObject *>(left) == *reinterpret_cast<StringObject *>(right);
+    }
+    inline void setControl(MapObject *map, size_t slot, uint8_t value) {
+        map->control[slot] = value;
+        if (slot < MapObject::groupWidth)
+            map->control[map->capacity + slot] = value;
+    }
+}// namespace
+
+uint64_t MapObject::hashOf(uint64_t key) const {
+    if (stringKeys())
+        key = reinterpret_cast<StringObject *>(key)->hashCode();
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccd;
+    key ^= key >> 33;
+    return key;
+}
+
+size_t MapObject::find(uint64_t key) const {
+    if (size == 0) return npos;
+    auto hash = hashOf(key);
+    auto mask = capacity - 1;
+    auto position = (hash >> 7) & mask;
+    for (size_t step = groupWidth;; step += groupWidth) {
+        Group group(control + position);
+        for (auto matches = group.match(h2(hash)); matches != 0; matches &= matches - 1) {
+            auto slot = (position + __builtin_ctz(matches)) & mask;
+            if (keysEqual(this, keys[slot], key))
+                return slot;
+        }
+        if (group.matchEmpty() != 0)
+            return npos;
+        position = (position + step) & mask;
+    }
+}
+
+size_t MapObject::insert(uint64_t key) {
+    auto hash = hashOf(key);
+    auto mask = capacity - 1;
+    auto position = (hash >> 7) & mask;
+    for (size_t step = groupWidth;; step += groupWidth) {
+        auto free = Group(control + position).matchFree();
+        if (free != 0) {
+            auto slot = (position + __builtin_ctz(free)) & mask;
+            if (control[slot] == empty)
+                growthLeft--;
+            setControl(this, slot, h2(hash));
+            keys[slot] = key;
+            size++;
+            return slot;
+        }
+        position = (position + step) & mask;
+    }
+}
+
+void MapObject::erase(size_t slot) {
+    setControl(this, slot, deleted);
+    size--;
+}
+
+void *MapObject::rehash(void *storage, size_t newCapacity) {
+    auto oldControl = control;
+    auto oldKeys = keys;
+    auto oldValues = values;
+    auto oldCapacity = capacity;
+    control = static_cast<uint8_t *>(storage);
+    keys = reinterpret_cast<uint64_t *>(control + newCapacity + groupWidth);
+    values = keys + newCapacity;
+    capacity = newCapacity;
+    growthLeft = newCapacity - newCapacity / 8;
+    size = 0;
+    std::memset(control, empty, newCapacity + groupWidth);
+    for (size_t i = 0; i < oldCapacity; i++) {
+        if (oldControl[i] & 0x80) continue;
+        values[insert(oldKeys[i])] = oldValues[i];
+    }
+    return oldControl;
+}
@@ -39,22 +39,32 @@
 %token Plus Minus Multiply Divide Modulo Assign
 %token Increment Decrement IncrementAssign DecrementAssign
 %token Equal NotEqual Less Greater LessEqual GreaterEqual And Or Not
+%token BitAnd BitOr BitXor BitNot ShiftLeft ShiftRight
 %token Define Function If Else While For Return
-%token Void Int UInt Float Bool True False Str
-%token Colon Comma Semicolon Arrow Newline QuestionMark
+%token Void Int UInt Float Bool True False Str Map Struct Soa
+%token Int8 Int16 Int32 UInt8 Float32 Compressed
+%token Colon Comma Dot Semicolon Arrow Newline QuestionMark
 %token LParen RParen LBrace RBrace LBracket RBracket
 %token Import Export
 
 %token <str> Number DecimalNumber String Identifier
 %type <ast> Expression Expressions VarType ScopedBody TypeCast FunctionCall IfStatement WhileStatement ForLoop
-%type <ast> ArgumentDeclaration ArgumentDeclarationsList Arguments FunctionDeclaration UnaryExpression
-%type <ast> List Elements ArrayType ArrayAccess
+%type <ast> ArgumentDeclaration ArgumentDeclarationsList Arguments FunctionDeclaration StructDeclaration UnaryExpression
+%type <ast> List Elements ArrayType MapType MatrixType SoaType ArrayAccess MatrixAccess FieldAccess ArraySlice
 
 %right QuestionMark Colon
+%left Or
+%left And
 %left Equal NotEqual
 %left Less Greater LessEqual GreaterEqual
+%left BitOr
+%left BitXor
+%left BitAnd
+%left ShiftLeft ShiftRight
 %left Plus Minus
 %left Multiply Divide Modulo
+%right Not BitNot
+%left Dot
 
 %%
 
@@ -77,6 +87,21 @@ ArrayAccess:
         $$ = new ArrayAccess(Node({Identifier, $1}), static_cast<AbstractSyntaxTree*>($3));
     }
 
+MatrixAccess:
+    Identifier LBracket Expression Comma Expression RBracket {
+        $$ = new MatrixAccess(Node({Identifier, $1}), static_cast<AbstractSyntaxTree*>($3), static_cast<AbstractSyntaxTree*>($5));
+    }
+
+FieldAccess:
+    Expression Dot Identifier {
+        $$ = new FieldAccess(static_cast<AbstractSyntaxTree*>($1), Node({Identifier, $3}));
+    }
+
+ArraySlice:
+    Identifier LBracket Expression Colon Expression RBracket {
+        $$ = new ArraySlice(Node({Identifier, $1}), static_cast<AbstractSyntaxTree*>($3), static_cast<AbstractSyntaxTree*>($5));
+    }
+
 List:
     LBracket RBracket {
         $$ = new List({});
@@ -88,8 +113,8 @@ List:
 
 Elements:
     | Elements Comma Expression {
-        elements->push_back(static_cast<AbstractSyntaxTree*>($3));
-        $$ = elements;
+        static_cast<std::vector<AbstractSyntaxTree*>*>($1)->push_back(static_cast<AbstractSyntaxTree*>($3));
+        $$ = $1;
     }
     | Expression {
         elements = new std::vector<AbstractSyntaxTree*>();
@@ -124,20 +149,53 @@ ArrayType:
     }
 ;
 
+MatrixType:
+    VarType LBracket Comma RBracket {
+        $$ = new MatrixType(static_cast<AbstractSyntaxTree*>($1));
+    }
+    | VarType LBracket Expression Comma Expression RBracket {
+        $$ = new MatrixType(static_cast<AbstractSyntaxTree*>($1), static_cast<AbstractSyntaxTree*>($3), static_cast<AbstractSyntaxTree*>($5));
+    }
+;
+
+MapType:
+    Map LParen VarType Comma VarType RParen {
+        $$ = new MapType(static_cast<AbstractSyntaxTree*>($3), static_cast<AbstractSyntaxTree*>($5));
+    }
+;
+
+SoaType:
+    Soa LParen Identifier RParen {
+        $$ = new SoaType(Node({Identifier, $3}));
+    }
+;
+
 VarType:
     Void { $$ = new Node({Void, "void"}); }
     | Int  { $$ = new Node({Int, "int"}); }
     | UInt { $$ = new Node({UInt, "uint"}); }
+    | Int8 { $$ = new Node({Int8, "i8"}); }
+    | Int16 { $$ = new Node({Int16, "i16"}); }
+    | Int32 { $$ = new Node({Int32, "i32"}); }
+    | UInt8 { $$ = new Node({UInt8, "u8"}); }
+    | Float32 { $$ = new Node({Float32, "f32"}); }
     | Float { $$ = new Node({Float, "float"}); }
     | Bool { $$ = new Node({Bool, "bool"}); }
     | Str { $$ = new Node({Str, "str"}); }
+    | Compressed { $$ = new Node({Compressed, "compressed"}); }
     | ArrayType { $$ = $1; }
+    | MapType { $$ = $1; }
+    | MatrixType { $$ = $1; }
+    | SoaType { $$ = $1; }
 ;
 
 ArgumentDeclaration:
     Identifier Colon VarType {
         $$ = new Declaration(static_cast<AbstractSyntaxTree*>($3), Node({Identifier, $1}));
     }
+    | Identifier Colon Identifier {
+        $$ = new Declaration(new Node({Identifier, $3}), Node({Identifier, $1}));
+    }
 ;
 
 ArgumentDeclarationsList:
@@ -147,8 +205,8 @@ ArgumentDeclarationsList:
         $$ = declarations;
     }
     | ArgumentDeclarationsList Comma ArgumentDeclaration {
-        declarations->push_back(static_cast<Declaration*>($3));
-        $$ = declarations;
+        static_cast<std::vector<Declaration*>*>($1)->push_back(static_cast<Declaration*>($3));
+        $$ = $1;
     }
 ;
 
@@ -160,6 +218,20 @@ FunctionDeclaration:
         $$ = new FunctionDeclaration(static_cast<AbstractSyntaxTree*>($6), *static_cast<std::vector<Declaration*>*>($3));
         delete static_cast<std::vector<Declaration*>*>($3);
     }
+    | Function LParen RParen Arrow Identifier {
+        $$ = new FunctionDeclaration(new Node({Identifier, $5}), {});
+    }
+    | Function LParen ArgumentDeclarationsList RParen Arrow Identifier {
+        $$ = new FunctionDeclaration(new Node({Identifier, $6}), *static_cast<std::vector<Declaration*>*>($3));
+        delete static_cast<std::vector<Declaration*>*>($3);
+    }
+;
+
+StructDeclaration:
+    Struct LParen ArgumentDeclarationsList RParen {
+        $$ = new StructDeclaration(*static_cast<std::vector<Declaration*>*>($3));
+        delete static_cast<std::vector<Declaration*>*>($3);
+    }
 ;
 
 TypeCast:
@@ -194,8 +266,8 @@ Arguments:
         $$ = expressions;
     }
     | Arguments Comma Expression {
-        expressions->push_back(static_cast<AbstractSyntaxTree*>($3));
-        $$ = expressions;
+        static_cast<std::vector<AbstractSyntaxTree*>*>($1)->push_back(static_cast<AbstractSyntaxTree*>($3));
+        $$ = $1;
     }
 ;
 
@@ -221,6 +293,12 @@ UnaryExpression:
     | Decrement Expression {
         $$ = new UnaryExpression(static_cast<AbstractSyntaxTree*>($2), {Decrement, "--"}, UnaryExpression::Side::LEFT);
     }
+    | Not Expression {
+        $$ = new UnaryExpression(static_cast<AbstractSyntaxTree*>($2), {Not, "!"}, UnaryExpression::Side::LEFT);
+    }
+    | BitNot Expression {
+        $$ = new UnaryExpression(static_cast<AbstractSyntaxTree*>($2), {BitNot, "~"}, UnaryExpression::Side::LEFT);
+    }
 ;
 
 Expression:
@@ -231,6 +309,7 @@ Expression:
     | DecimalNumber { $$ = new Node({DecimalNumber, $1}); }
     | String { $$ = new Node({String, $1}); }
     | FunctionDeclaration { $$ = $1; }
+    | StructDeclaration { $$ = $1; }
     | VarType { $$ = $1; }
     | ScopedBody { $$ = $1; }
     | TypeCast { $$ = $1; }
@@ -241,6 +320,9 @@ Expression:
     | UnaryExpression { $$ = $1; }
     | List { $$ = $1; }
     | ArrayAccess { $$ = $1; }
+    | MatrixAccess { $$ = $1; }
+    | FieldAccess { $$ = $1; }
+    | ArraySlice { $$ = $1; }
     | Return Expression {
         $$ = new ReturnStatement(static_cast<AbstractSyntaxTree*>($2));
     }
@@ -271,6 +353,27 @@ Expression:
     | Expression Modulo Expression {
         $$ = new BinaryExpression(static_cast<AbstractSyntaxTree*>($1), static_cast<AbstractSyntaxTree*>($3), {Modulo, "%"});
     }
+    | Expression And Expression {
+        $$ = new BinaryExpression(static_cast<AbstractSyntaxTree*>($1), static_cast<AbstractSyntaxTree*>($3), {And, "&&"});
+    }
+    | Expression Or Expression {
+        $$ = new BinaryExpression(static_cast<AbstractSyntaxTree*>($1), static_cast<AbstractSyntaxTree*>($3), {Or, "||"});
+    }
+    | Expression BitAnd Expression {
+        $$ = new BinaryExpression(static_cast<AbstractSyntaxTree*>($1), static_cast<AbstractSyntaxTree*>($3), {BitAnd, "&"});
+    }
+    | Expression BitOr Expression {
+        $$ = new BinaryExpression(static_cast<AbstractSyntaxTree*>($1), static_cast<AbstractSyntaxTree*>($3), {BitOr, "|"});
+    }
+    | Expression BitXor Expression {
+        $$ = new BinaryExpression(static_cast<AbstractSyntaxTree*>($1), static_cast<AbstractSyntaxTree*>($3), {BitXor, "^"});
+    }
+    | Expression ShiftLeft Expression {
+        $$ = new BinaryExpression(static_cast<AbstractSyntaxTree*>($1), static_cast<AbstractSyntaxTree*>($3), {ShiftLeft, "<<"});
+    }
+    | Expression ShiftRight Expression {
+        $$ = new BinaryExpression(static_cast<AbstractSyntaxTree*>($1), static_cast<AbstractSyntaxTree*>($3), {ShiftRight, ">>"});
+    }
     | Expression Assign Expression {
         $$ = new BinaryExpression(static_cast<AbstractSyntaxTree*>($1), static_cast<AbstractSyntaxTree*>($3), {Assign, "="});
     }
@@ -0,0 +1,140 @@
+#include "sort.h"
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace {
+    constexpr uint64_t signBit = uint64_t(1) << 63;
+    // Below this radix sort loses to a comparison sort
+    constexpr size_t radixThreshold = 256;
+
+    struct I64Key {
+        static uint64_t encode(uint64_t value) {
+            return value ^ signBit;
+        }
+        static uint64_t decode(uint64_t key) {
+            return key ^ signBit;
+        }
+    };
+    // Negative doubles order in reverse of their bits, so they are inverted
+    // entirely while non-negative ones only get the sign bit set
+    struct F64Key {
+        static uint64_t encode(uint64_t value) {
+            return value ^ ((uint64_t) ((int64_t) value >> 63) | signBit);
+        }
+        static uint64_t decode(uint64_t key) {
+            return key ^ (((key >> 63) - 1) | signBit);
+        }
+    };
+
+    // Runs task(0) .. task(count - 1) on up to threads threads, the calling
+    // thread included
+    template<typename Task>
+    void parallelFor(size_t count, size_t threads, Task &&task) {
+        std::atomic<size_t> next = 0;
+        auto work = [&] {
+            for (size_t i = next++; i < count; i = next++)
+                task(i);
+        };
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < std::min(threads, count); i++)
+            workers.emplace_back(work);
+        work();
+        for (auto &worker: workers)
+            worker.join();
+    }
+
+    // LSD radix sort, one byte per pass. All eight histograms are built in a
+    // single pass and bytes shared by every key are skipped.
+    void radixSort(uint64_t *keys, uint64_t *scratch, size_t size) {
+        if (size < radixThreshold) {
+            std::stable_sort(keys, keys + size);
+            return;
+        }
+        size_t counts[8][256] = {};
+        for (size_t i = 0; i < size; i++) {
+            for (size_t digit = 0; digit < 8; digit++)
+                counts[digit][(keys[i] >> (8 * digit)) & 0xFF]++;
+        }
+        auto source = keys, destination = scratch;
+        for (size_t digit = 0; digit < 8; digit++) {
+            auto shift = 8 * digit;
+            if (counts[digit][(source[0] >> shift) & 0xFF] == size)
+                continue;
+            size_t offsets[256];
+            size_t offset = 0;
+            for (size_t bucket = 0; bucket < 256; bucket++) {
+                offsets[bucket] = offset;
+                offset += counts[digit][bucket];
+            }
+            for (size_t i = 0; i < size; i++)
+                destination[offsets[(source[i] >> shift) & 0xFF]++] = source[i];
+            std::swap(source, destination);
+        }
+        if (source != keys)
+            std::memcpy(keys, source, size * sizeof(uint64_t));
+    }
+
+    template<typename Key>
+    void sort(uint64_t *data, size_t size, bool stable, size_t threads, size_t parallelThreshold) {
+        if (size < 2) return;
+        if (size < std::max<size_t>(parallelThreshold, 2) || threads <= 1) {
+            for (size_t i = 0; i < size; i++)
+                data[i] = Key::encode(data[i]);
+            if (stable) {
+                auto scratch = std::make_unique<uint64_t[]>(size);
+                radixSort(data, scratch.get(), size);
+            } else {
+                std::sort(data, data + size);
+            }
+            for (size_t i = 0; i < size; i++)
+                data[i] = Key::decode(data[i]);
+            return;
+        }
+        auto scratch = std::make_unique<uint64_t[]>(size);
+        std::vector<size_t> bounds;
+        for (size_t run = 0; run <= threads; run++)
+            bounds.push_back(size * run / threads);
+        parallelFor(threads, threads, [&](size_t run) {
+            auto begin = bounds[run], end = bounds[run + 1];
+            for (size_t i = begin; i < end; i++)
+                data[i] = Key::encode(data[i]);
+            if (stable)
+                radixSort(data + begin, scratch.get() + begin, end - begin);
+            else
+                std::sort(data + begin, data + end);
+        });
+        // Merging takes from the left run first on ties, which keeps the
+        // stable variant stable
+        auto source = data, destination = scratch.get();
+        while (bounds.size() > 2) {
+            auto runs = bounds.size() - 1;
+            parallelFor((runs + 1) / 2, threads, [&](size_t pair) {
+                auto begin = bounds[2 * pair], middle = bounds[std::min(2 * pair + 1, runs)];
+                auto end = bounds[std::min(2 * pair + 2, runs)];
+                std::merge(source + begin, source + middle, source + middle, source + end, destination + begin);
+            });
+            std::vector<size_t> merged;
+            for (size_t i = 0; i < bounds.size(); i += 2)
+                merged.push_back(bounds[i]);
+            if (merged.back() != size)
+                merged.push_back(size);
+            bounds = std::move(merged);
+            std::swap(source, destination);
+        }
+        parallelFor(threads, threads, [&](size_t run) {
+            for (size_t i = size * run / threads; i < size * (run + 1) / threads; i++)
+                data[i] = Key::decode(source[i]);
+        });
+    }
+}// namespace
+
+void sortI64(uint64_t *data, size_t size, bool stable, size_t threads, size_t parallelThreshold) {
+    sort<I64Key>(data, size, stable, threads, parallelThreshold);
+}
+void sortF64(uint64_t *data, size_t size, bool stable, size_t threads, size_t parallelThreshold) {
+    sort<F64Key>(data, size, stable, threads, parallelThreshold);
+}
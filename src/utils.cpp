@@ -5,7 +5,113 @@ void assert(bool condition, const char *message) {
         throw std::runtime_error("Assertion failed: " + std::string(message));
 }
 
-VariableType *varTypeConvert(AbstractSyntaxTree *ast) {
+#define ARRAY_KERNEL_BUILTINS(TYPE)                                                                                 \
+    {"sum", {Instruction::ArraySum##TYPE, VariableType::TYPE, {VariableType::Array}, VariableType::TYPE}},                  \
+    {"min", {Instruction::ArrayMin##TYPE, VariableType::TYPE, {VariableType::Array}, VariableType::TYPE}},                  \
+    {"max", {Instruction::ArrayMax##TYPE, VariableType::TYPE, {VariableType::Array}, VariableType::TYPE}},                  \
+    {"dot", {Instruction::ArrayDot##TYPE, VariableType::TYPE, {VariableType::Array, VariableType::Array}, VariableType::TYPE}}, \
+    {"scale", {Instruction::ArrayScale##TYPE, VariableType::Void, {VariableType::Array, VariableType::TYPE}, VariableType::TYPE}}, \
+    {"add", {Instruction::ArrayAdd##TYPE, VariableType::Void, {VariableType::Array, VariableType::Array}, VariableType::TYPE}}, \
+    {"fill", {Instruction::ArrayFill##TYPE, VariableType::Void, {VariableType::Array, VariableType::TYPE}, VariableType::TYPE}}, \
+    {"count_if_equal", {Instruction::ArrayCountEqual##TYPE, VariableType::I64, {VariableType::Array, VariableType::TYPE}, VariableType::TYPE}}, \
+    {"sort", {Instruction::ArraySort##TYPE, VariableType::Void, {VariableType::Array}, VariableType::TYPE}},                \
+    {"sort_unstable", {Instruction::ArraySortUnstable##TYPE, VariableType::Void, {VariableType::Array}, VariableType::TYPE}}
+#define MATRIX_KERNEL_BUILTINS(TYPE)                                                                                            \
+    {"add", {Instruction::MatrixAdd##TYPE, VariableType::Void, {VariableType::Matrix, VariableType::Matrix}, VariableType::TYPE}}, \
+    {"scale", {Instruction::MatrixScale##TYPE, VariableType::Void, {VariableType::Matrix, VariableType::TYPE}, VariableType::TYPE}}, \
+    {"fill", {Instruction::MatrixFill, VariableType::Void, {VariableType::Matrix, VariableType::TYPE}, VariableType::TYPE}},        \
+    {"sum", {Instruction::MatrixSum##TYPE, VariableType::TYPE, {VariableType::Matrix}, VariableType::TYPE}},                     \
+    {"transpose", {Instruction::MatrixTranspose, VariableType::Matrix, {VariableType::Matrix}, VariableType::TYPE, VariableType::TYPE}}, \
+    {"matmul", {Instruction::MatrixMultiply##TYPE, VariableType::Matrix, {VariableType::Matrix, VariableType::Matrix}, VariableType::TYPE, VariableType::TYPE}}
+const Builtin *findBuiltin(Program &program, Segment &segment, const std::string &name,
+                           const std::vector<AbstractSyntaxTree *> &arguments) {
+    static const std::unordered_multimap<std::string, Builtin> builtins = {
+            {"reserve", {Instruction::ReserveArray, VariableType::Void, {VariableType::Array, VariableType::I64}}},
+            {"shrink", {Instruction::ShrinkArray, VariableType::Void, {VariableType::Array}}},
+            {"intern", {Instruction::InternString, VariableType::Object, {VariableType::Object}}},
+            {"len", {Instruction::StringLength, VariableType::I64, {VariableType::Object}}},
+            {"len", {Instruction::MapSize, VariableType::I64, {VariableType::Map}}},
+            {"len", {Instruction::ArrayLength, VariableType::I64, {VariableType::Array}}},
+            {"len", {Instruction::SoaLength, VariableType::I64, {VariableType::Soa}}},
+            {"len", {Instruction::CompressedLength, VariableType::I64, {VariableType::CompressedArray}}},
+            {"find", {Instruction::StringFind, VariableType::I64, {VariableType::Object, VariableType::Object}}},
+            {"contains", {Instruction::StringContains, VariableType::Bool, {VariableType::Object, VariableType::Object}}},
+            {"count", {Instruction::StringCount, VariableType::I64, {VariableType::Object, VariableType::Object}}},
+            {"starts_with", {Instruction::StringStartsWith, VariableType::Bool, {VariableType::Object, VariableType::Object}}},
+            {"split", {Instruction::StringSplit, VariableType::Array, {VariableType::Object, VariableType::Object}, VariableType::Invalid, VariableType::Object}},
+            {"reserve", {Instruction::ReserveMap, VariableType::Void, {VariableType::Map, VariableType::I64}}},
+            {"contains", {Instruction::MapContains, VariableType::Bool, {VariableType::Map, VariableType::I64}, VariableType::I64}},
+            {"contains", {Instruction::MapContains, VariableType::Bool, {VariableType::Map, VariableType::Object}, VariableType::Object}},
+            {"remove", {Instruction::MapRemove, VariableType::Bool, {VariableType::Map, VariableType::I64}, VariableType::I64}},
+            {"remove", {Instruction::MapRemove, VariableType::Bool, {VariableType::Map, VariableType::Object}, VariableType::Object}},
+            ARRAY_KERNEL_BUILTINS(I64),
+            ARRAY_KERNEL_BUILTINS(F64),
+            {"compress", {Instruction::CompressArray, VariableType::CompressedArray, {VariableType::Array}, VariableType::I64}},
+            {"decompress", {Instruction::DecompressArray, VariableType::Array, {VariableType::CompressedArray}, VariableType::Invalid, VariableType::I64}},
+            {"sum", {Instruction::CompressedSum, VariableType::I64, {VariableType::CompressedArray}}},
+            {"rows", {Instruction::MatrixRows, VariableType::I64, {VariableType::Matrix}}},
+            {"cols", {Instruction::MatrixCols, VariableType::I64, {VariableType::Matrix}}},
+            MATRIX_KERNEL_BUILTINS(I64),
+            MATRIX_KERNEL_BUILTINS(F64),
+    };
+    if (segment.functions.contains(name) || program.segments.front().functions.contains(name))
+        return nullptr;
+    auto [begin, end] = builtins.equal_range(name);
+    if (begin == end)
+        return nullptr;
+    auto type = VariableType::Invalid, elementType = VariableType::Invalid;
+    if (!arguments.empty()) {
+        type = deduceType(program, segment, arguments.front())->type;
+        elementType = deduceElementType(program, segment, arguments.front());
+    }
+    for (auto it = begin; it != end; it++) {
+        if (!it->second.arguments.empty() && it->second.arguments.front() != type)
+            continue;
+        if (it->second.elementType == VariableType::Invalid || it->second.elementType == elementType)
+            return &it->second;
+    }
+    throw std::runtime_error("[findBuiltin] No overload of " + name + " for the given arguments");
+}
+
+VariableType::Type deduceElementType(Program &program, Segment &segment, AbstractSyntaxTree *ast) {
+    if (ast->nodeType == AbstractSyntaxTree::Type::List) {
+        auto list = dynamic_cast<List *>(ast);
+        if (list->elements.empty())
+            return VariableType::I64;
+        return deduceType(program, segment, list->elements.front())->type;
+    }
+    std::string identifier;
+    VariableType *type;
+    if (ast->nodeType == AbstractSyntaxTree::Type::Node)
+        identifier = dynamic_cast<Node *>(ast)->token.value;
+    else if (ast->nodeType == AbstractSyntaxTree::Type::ArraySlice)
+        identifier = dynamic_cast<ArraySlice *>(ast)->identifier.token.value;
+    else if (ast->nodeType != AbstractSyntaxTree::Type::FunctionCall && ast->nodeType != AbstractSyntaxTree::Type::FieldAccess)
+        return VariableType::Invalid;
+    if (ast->nodeType == AbstractSyntaxTree::Type::FunctionCall || ast->nodeType == AbstractSyntaxTree::Type::FieldAccess)
+        type = deduceType(program, segment, ast);
+    else if (segment.find_local(identifier) != -1)
+        type = segment.locals[identifier].type;
+    else if (program.find_global(identifier) != -1)
+        type = program.segments[0].locals[identifier].type;
+    else
+        return VariableType::Invalid;
+    switch (type->type) {
+        case VariableType::Map:
+            return ((MapObjectType *) type)->keyType->type;
+        case VariableType::Array:
+            // Kernels expect word sized elements, packed arrays match no overload
+            if (((ArrayObjectType *) type)->elementType->narrow)
+                return VariableType::Invalid;
+            return ((ArrayObjectType *) type)->elementType->type;
+        case VariableType::Matrix:
+            return ((MatrixObjectType *) type)->elementType->type;
+        default:
+            return VariableType::Invalid;
+    }
+}
+
+VariableType *varTypeConvert(Program &program, AbstractSyntaxTree *ast) {
     if (ast->nodeType == AbstractSyntaxTree::Type::Node) {
         auto token = dynamic_cast<Node *>(ast)->token;
         switch (token.type) {
@@ -13,21 +119,70 @@ VariableType *varTypeConvert(AbstractSyntaxTree *ast) {
                 return new VariableType(VariableType::Bool);
             case Int:
                 return new VariableType(VariableType::I64);
+            case Float:
+                return new VariableType(VariableType::F64);
             case Str:
                 return new VariableType(VariableType::Object);
             case Void:
                 return new VariableType(VariableType::Void);
+            case Int8:
+                return new NarrowType(ArrayObject::ElementType::I8);
+            case Int16:
+                return new NarrowType(ArrayObject::ElementType::I16);
+            case Int32:
+                return new NarrowType(ArrayObject::ElementType::I32);
+            case UInt8:
+                return new NarrowType(ArrayObject::ElementType::U8);
+            case UInt:
+                return new NarrowType(ArrayObject::ElementType::U32);
+            case Float32:
+                return new NarrowType(ArrayObject::ElementType::F32);
+            case Compressed:
+                return new VariableType(VariableType::CompressedArray);
+            case Identifier:
+                if (program.structs.contains(token.value))
+                    return program.structs[token.value].get();
+                [[fallthrough]];
             default:
                 throw std::runtime_error("[Declaration::compile] Invalid type: " + token.value);
         }
     } else if (ast->nodeType == AbstractSyntaxTree::Type::ArrayType) {
         auto arrayType = dynamic_cast<ArrayType *>(ast);
-        return new ArrayObjectType(varTypeConvert(arrayType->type));
+        return new ArrayObjectType(varTypeConvert(program, arrayType->type));
+    } else if (ast->nodeType == AbstractSyntaxTree::Type::MapType) {
+        auto mapType = dynamic_cast<MapType *>(ast);
+        auto keyType = varTypeConvert(program, mapType->keyType);
+        if (keyType->type != VariableType::I64 && keyType->type != VariableType::Object)
+            throw std::runtime_error("[Declaration::compile] Map keys must be int or str");
+        return new MapObjectType(keyType, varTypeConvert(program, mapType->valueType));
+    } else if (ast->nodeType == AbstractSyntaxTree::Type::MatrixType) {
+        auto elementType = varTypeConvert(program, dynamic_cast<MatrixType *>(ast)->type);
+        if ((elementType->type != VariableType::I64 && elementType->type != VariableType::F64) || elementType->narrow)
+            throw std::runtime_error("[Declaration::compile] Matrix elements must be int or float");
+        return new MatrixObjectType(elementType);
+    } else if (ast->nodeType == AbstractSyntaxTree::Type::SoaType) {
+        auto &record = dynamic_cast<SoaType *>(ast)->record.token.value;
+        if (!program.structs.contains(record))
+            throw std::runtime_error("[Declaration::compile] soa needs a struct type: " + record);
+        return new SoaObjectType(program.structs[record].get());
     } else {
         throw std::runtime_error("[Declaration::compile] Invalid type: " + ast->typeStr);
     }
 }
 
+const StructType::Field &findField(Program &program, Segment &segment, const FieldAccess &access) {
+    auto type = deduceType(program, segment, access.object);
+    // Fields of soa records name whole columns
+    if (type->type == VariableType::Soa)
+        type = ((SoaObjectType *) type)->recordType;
+    if (type->type != VariableType::Struct)
+        throw std::runtime_error("[FieldAccess::compile] Not a struct: " + access.field.token.value);
+    auto field = ((StructType *) type)->find_field(access.field.token.value);
+    if (field == nullptr)
+        throw std::runtime_error("[FieldAccess::compile] " + ((StructType *) type)->name + " has no field " + access.field.token.value);
+    return *field;
+}
+
 VariableType::Type biggestType(VariableType::Type first, VariableType::Type second) {
     switch (first) {
         case VariableType::I64:
@@ -46,11 +201,19 @@ VariableType::Type biggestType(VariableType::Type first, VariableType::Type seco
                 default:
                     throw std::runtime_error("Type mismatch!");
             }
+        case VariableType::Object:
+            if (second != VariableType::Object)
+                throw std::runtime_error("Type mismatch!");
+            return first;
         default:
             throw std::runtime_error("Type mismatch!");
     }
 }
 
+bool isBitwise(int op) {
+    return op == BitAnd || op == BitOr || op == BitXor || op == ShiftLeft || op == ShiftRight;
+}
+
 VariableType *deduceType(Program &program, Segment &segment, AbstractSyntaxTree *ast) {
     switch (ast->nodeType) {
         case AbstractSyntaxTree::Type::Node: {
@@ -73,9 +236,9 @@ VariableType *deduceType(Program &program, Segment &segment, AbstractSyntaxTree
                 }
                 case Identifier: {
                     if (segment.find_local(token.value) != -1)
-                        return new VariableType(segment.locals[token.value].type->type);
+                        return segment.locals[token.value].type;
                     if (program.find_global(token.value) != -1)
-                        return new VariableType(program.segments[0].locals[token.value].type->type);
+                        return program.segments[0].locals[token.value].type;
                     throw std::runtime_error("Identifier not found: " + token.value);
                 }
                 default:
@@ -84,13 +247,20 @@ VariableType *deduceType(Program &program, Segment &segment, AbstractSyntaxTree
         }
         case AbstractSyntaxTree::Type::UnaryExpression: {
             auto unary = dynamic_cast<UnaryExpression *>(ast);
+            if (unary->op.type == BitNot)
+                return new VariableType(VariableType::I64);
+            if (unary->op.type == Not)
+                return new VariableType(VariableType::Bool);
             return deduceType(program, segment, unary->expression);
         }
         case AbstractSyntaxTree::Type::BinaryExpression: {
             auto binaryExpr = dynamic_cast<BinaryExpression *>(ast);
             if (binaryExpr->op.type == Less || binaryExpr->op.type == Greater || binaryExpr->op.type == LessEqual ||
-                binaryExpr->op.type == GreaterEqual || binaryExpr->op.type == Equal || binaryExpr->op.type == NotEqual)
+                binaryExpr->op.type == GreaterEqual || binaryExpr->op.type == Equal || binaryExpr->op.type == NotEqual ||
+                binaryExpr->op.type == And || binaryExpr->op.type == Or)
                 return new VariableType(VariableType::Bool);
+            if (isBitwise(binaryExpr->op.type))
+                return new VariableType(VariableType::I64);
             auto left = deduceType(program, segment, binaryExpr->left);
             auto right = deduceType(program, segment, binaryExpr->right);
             return new VariableType(biggestType(left->type, right->type));
@@ -105,13 +275,24 @@ VariableType *deduceType(Program &program, Segment &segment, AbstractSyntaxTree
             if (call->identifier.token.value == "native") {
                 return new VariableType(VariableType::NativeLib);
             }
+            if (program.structs.contains(call->identifier.token.value))
+                return program.structs[call->identifier.token.value].get();
+            if (auto builtin = findBuiltin(program, segment, call->identifier.token.value, call->arguments)) {
+                if (builtin->returnType == VariableType::Array)
+                    return new ArrayObjectType(new VariableType(builtin->returnElementType));
+                if (builtin->returnType == VariableType::Matrix)
+                    return new MatrixObjectType(new VariableType(builtin->returnElementType));
+                return new VariableType(builtin->returnType);
+            }
             auto function = program.find_function(segment, call->identifier.token.value);
-            return new VariableType(((FunctionType *) function.type)->returnType->type);
+            return ((FunctionType *) function.type)->returnType;
         }
+        case AbstractSyntaxTree::Type::TypeCast:
+            return varTypeConvert(program, dynamic_cast<TypeCast *>(ast)->type);
         case AbstractSyntaxTree::Type::Declaration: {
             auto declaration = dynamic_cast<Declaration *>(ast);
             if (declaration->type.has_value())
-                return varTypeConvert(declaration->type.value());
+                return varTypeConvert(program, declaration->type.value());
             return deduceType(program, segment, declaration->value.value());
         }
         case AbstractSyntaxTree::Type::ArrayAccess: {
@@ -125,8 +306,50 @@ VariableType *deduceType(Program &program, Segment &segment, AbstractSyntaxTree
                 throw std::runtime_error("Identifier not found: " + arrayAccess->identifier.token.value);
             auto type = (ArrayObjectType *) (isLocal ? segment.locals[arrayAccess->identifier.token.value].type
                                                      : program.segments[0].locals[arrayAccess->identifier.token.value].type);
+            if (type->type == VariableType::Object)
+                return new VariableType(VariableType::I64);
+            if (type->type == VariableType::Map)
+                return ((MapObjectType *) type)->valueType;
+            if (type->type == VariableType::Soa)
+                return ((SoaObjectType *) type)->recordType;
+            if (type->type == VariableType::CompressedArray)
+                return new VariableType(VariableType::I64);
             return type->elementType;
         } break;
+        case AbstractSyntaxTree::Type::FieldAccess: {
+            auto fieldAccess = dynamic_cast<FieldAccess *>(ast);
+            auto fieldType = findField(program, segment, *fieldAccess).type;
+            if (deduceType(program, segment, fieldAccess->object)->type == VariableType::Soa)
+                return new ArrayObjectType(fieldType);
+            return fieldType;
+        }
+        case AbstractSyntaxTree::Type::MatrixAccess: {
+            auto matrixAccess = dynamic_cast<MatrixAccess *>(ast);
+            auto &identifier = matrixAccess->identifier.token.value;
+            VariableType *type;
+            if (segment.find_local(identifier) != -1)
+                type = segment.locals[identifier].type;
+            else if (program.find_global(identifier) != -1)
+                type = program.segments[0].locals[identifier].type;
+            else
+                throw std::runtime_error("Identifier not found: " + identifier);
+            if (type->type != VariableType::Matrix)
+                throw std::runtime_error("Not a matrix: " + matrixAccess->identifier.token.value);
+            return ((MatrixObjectType *) type)->elementType;
+        }
+        case AbstractSyntaxTree::Type::ArraySlice: {
+            auto arraySlice = dynamic_cast<ArraySlice *>(ast);
+            auto type = deduceType(program, segment, &arraySlice->identifier);
+            if (type->type != VariableType::Array)
+                throw std::runtime_error("Not an array: " + arraySlice->identifier.token.value);
+            return new ArrayObjectType(((ArrayObjectType *) type)->elementType);
+        }
+        case AbstractSyntaxTree::Type::List: {
+            auto list = dynamic_cast<List *>(ast);
+            if (list->elements.empty())
+                return new ArrayObjectType(new VariableType(VariableType::I64));
+            return new ArrayObjectType(deduceType(program, segment, list->elements.front()));
+        }
         default:
             throw std::runtime_error("Invalid type: " + ast->typeStr);
     }
@@ -144,6 +367,18 @@ VariableType *deduceType(Program &program, Segment &segment, AbstractSyntaxTree
         }                                                                          \
     }
 Instruction getInstructionWithType(GenericInstruction instruction, VariableType::Type type) {
+    if (type == VariableType::Object) {
+        switch (instruction) {
+            case GenericInstruction::Add:
+                return {Instruction::ConcatString};
+            case GenericInstruction::Equal:
+                return {Instruction::EqualString};
+            case GenericInstruction::NotEqual:
+                return {Instruction::NotEqualString};
+            default:
+                throw std::runtime_error("[getInstructionWithType] Invalid type");
+        }
+    }
     switch (instruction) {
         TYPE_CASE(Add)
         TYPE_CASE(Sub)
@@ -166,6 +401,36 @@ Instruction getInstructionWithType(GenericInstruction instruction, VariableType:
     }
 }
 
+#define ARRAY_CASE(INS)                                                        \
+    case ArrayInstruction::INS:                                                \
+        if (elementType->narrow)                                               \
+            return storageOf(elementType) == ArrayObject::ElementType::F32     \
+                           ? Instruction::INS##F32                             \
+                           : Instruction::INS##Packed;                         \
+        switch (elementType->type) {                                           \
+            case VariableType::I64:                                            \
+                return Instruction::INS##I64;                                  \
+            case VariableType::F64:                                            \
+                return Instruction::INS##F64;                                  \
+            case VariableType::Bool:                                           \
+                return Instruction::INS##Bool;                                 \
+            case VariableType::Object:                                         \
+                return Instruction::INS##Object;                               \
+            default:                                                           \
+                throw std::runtime_error("[getArrayInstruction] Invalid type"); \
+        }
+Instruction::InstructionType getArrayInstruction(ArrayInstruction instruction, const VariableType *elementType) {
+    switch (instruction) {
+        ARRAY_CASE(MakeArray)
+        ARRAY_CASE(LoadFromLocalArray)
+        ARRAY_CASE(LoadFromGlobalArray)
+        ARRAY_CASE(StoreToLocalArray)
+        ARRAY_CASE(StoreToGlobalArray)
+        ARRAY_CASE(AppendToArray)
+    }
+    throw std::runtime_error("[getArrayInstruction] Invalid instruction");
+}
+
 Instruction emitLoad(VariableType::Type type, const Token &token) {
     switch (type) {
         case VariableType::Bool:
@@ -211,6 +476,12 @@ void typeCast(std::vector<Instruction> &instructions, VariableType::Type from, V
     }
 }
 
+void typeCast(std::vector<Instruction> &instructions, VariableType::Type from, const VariableType *to) {
+    typeCast(instructions, from, to->type);
+    if (to->narrow)
+        instructions.push_back({.type = Instruction::Narrow, .params = {.index = (size_t) storageOf(to)}});
+}
+
 #define COND_CASE(TYPE)                   \
     case Instruction::Equal##TYPE:        \
     case Instruction::Less##TYPE:         \
@@ -232,12 +503,25 @@ void typeCast(std::vector<Instruction> &instructions, VariableType::Type from, V
     case Instruction::LoadGlobal##TYPE
 VariableType::Type getInstructionType(const Program &program, const Instruction &instruction) {
     switch (instruction.type) {
-        COND_CASE(I64) : COND_CASE(F64) : {
+        COND_CASE(I64) : COND_CASE(F64) : case Instruction::EqualString:
+    case Instruction::NotEqualString:
+    case Instruction::MapContains:
+    case Instruction::MapRemove:
+    case Instruction::StringContains:
+    case Instruction::StringStartsWith: {
             return VariableType::Bool;
         }
     OP_CASE(F64) : case Instruction::ConvertI64ToF64:
         return VariableType::F64;
     OP_CASE(I64) : case Instruction::ModI64:
+    case Instruction::BitAndI64:
+    case Instruction::BitOrI64:
+    case Instruction::BitXorI64:
+    case Instruction::BitNotI64:
+    case Instruction::ShiftLeftI64:
+    case Instruction::ShiftRightI64:
+    case Instruction::ShiftLeftConstI64:
+    case Instruction::ShiftRightConstI64:
     case Instruction::ConvertF64ToI64:
         return VariableType::I64;
     case Instruction::LoadObject:
@@ -245,29 +529,274 @@ VariableType::Type getInstructionType(const Program &program, const Instruction
     case Instruction::LoadLocalObject:
     case Instruction::StoreGlobalObject:
     case Instruction::LoadGlobalObject:
-    case Instruction::MakeArray:
+    case Instruction::SliceArray:
+    case Instruction::InternString:
+    case Instruction::MakeMap:
+    case Instruction::MakeMatrix:
+    case Instruction::MakeStruct:
+    case Instruction::LoadObjectField:
+    case Instruction::MakeSoa:
+    case Instruction::AppendToSoa:
+    case Instruction::AppendStructToSoa:
+    case Instruction::LoadSoaObjectField:
+    case Instruction::LoadSoaColumn:
+    case Instruction::LoadSoaRecord:
+    case Instruction::CompressArray:
+    case Instruction::DecompressArray:
+    case Instruction::MatrixTranspose:
+    case Instruction::MatrixMultiplyI64:
+    case Instruction::MatrixMultiplyF64:
+    case Instruction::ConcatString:
+    case Instruction::FreezeString:
+    case Instruction::MakeArrayI64:
+    case Instruction::MakeArrayF64:
+    case Instruction::MakeArrayBool:
+    case Instruction::MakeArrayObject:
+    case Instruction::AppendToArrayObject:
+    case Instruction::LoadFromLocalArrayObject:
+    case Instruction::LoadFromGlobalArrayObject:
+    case Instruction::StringSplit:
+    case Instruction::AppendToArrayI64:
+    case Instruction::AppendToArrayF64:
+    case Instruction::AppendToArrayBool:
+    case Instruction::MakeArrayPacked:
+    case Instruction::MakeArrayF32:
+    case Instruction::AppendToArrayPacked:
+    case Instruction::AppendToArrayF32:
         return VariableType::Object;
-    case Instruction::LoadFromLocalArray:
-    case Instruction::LoadFromGlobalArray: {
-        auto array_index = instruction.params.index;
-        auto locals = program.segments[0].locals;
-        for (auto &local: locals) {
-            if (local.second.index == array_index) {
-                auto type = (ArrayObjectType *) local.second.type;
-                return type->elementType->type;
-            }
-        }
-    } break;
+    case Instruction::LoadFromLocalArrayPacked:
+    case Instruction::LoadFromGlobalArrayPacked:
+        return VariableType::I64;
+    case Instruction::LoadFromLocalArrayF32:
+    case Instruction::LoadFromGlobalArrayF32:
+        return VariableType::F64;
+    case Instruction::Narrow:
+        return (ArrayObject::ElementType) instruction.params.index == ArrayObject::ElementType::F32 ? VariableType::F64
+                                                                                                     : VariableType::I64;
+    case Instruction::LoadFromLocalArrayI64:
+    case Instruction::LoadFromGlobalArrayI64:
+        return VariableType::I64;
+    case Instruction::LoadFromLocalArrayF64:
+    case Instruction::LoadFromGlobalArrayF64:
+        return VariableType::F64;
+    case Instruction::LoadFromLocalArrayBool:
+    case Instruction::LoadFromGlobalArrayBool:
+        return VariableType::Bool;
+    case Instruction::MapGet: {
+        auto valueType = MapObject::valueTypeOf(instruction.params.index);
+        return MapObject::isObjectType(valueType) ? VariableType::Object : valueType;
+    }
     case Instruction::Call: {
         auto func_index = instruction.params.index;
         auto function = program.segments[func_index];
         return function.returnType->type;
     }
+    case Instruction::StringLength:
+    case Instruction::MapSize:
+    case Instruction::ArrayLength:
+    case Instruction::SoaLength:
+    case Instruction::CompressedLength:
+    case Instruction::CompressedSum:
+    case Instruction::LoadCompressedElement:
+    case Instruction::StringFind:
+    case Instruction::StringCount:
+    case Instruction::LoadStringChar:
+    case Instruction::ArraySumI64:
+    case Instruction::ArrayMinI64:
+    case Instruction::ArrayMaxI64:
+    case Instruction::ArrayDotI64:
+    case Instruction::ArrayCountEqualI64:
+    case Instruction::ArrayCountEqualF64:
+    case Instruction::MatrixRows:
+    case Instruction::MatrixCols:
+    case Instruction::MatrixSumI64:
+        return VariableType::I64;
+    case Instruction::ArraySumF64:
+    case Instruction::ArrayMinF64:
+    case Instruction::ArrayMaxF64:
+    case Instruction::ArrayDotF64:
+    case Instruction::MatrixSumF64:
+        return VariableType::F64;
+    case Instruction::LoadMatrixElement:
+        return (VariableType::Type) instruction.params.index;
+    case Instruction::LoadField:
+    case Instruction::LoadSoaField:
+        return StructObject::typeOf(instruction.params.index);
+    case Instruction::ReserveArray:
+    case Instruction::ReserveMap:
+    case Instruction::ShrinkArray:
+    case Instruction::ArrayScaleI64:
+    case Instruction::ArrayScaleF64:
+    case Instruction::ArrayAddI64:
+    case Instruction::ArrayAddF64:
+    case Instruction::ArrayFillI64:
+    case Instruction::ArrayFillF64:
+    case Instruction::ArraySortI64:
+    case Instruction::ArraySortF64:
+    case Instruction::ArraySortUnstableI64:
+    case Instruction::ArraySortUnstableF64:
+    case Instruction::StoreMatrixElement:
+    case Instruction::StoreField:
+    case Instruction::StoreObjectField:
+    case Instruction::StoreSoaField:
+    case Instruction::StoreSoaObjectField:
+    case Instruction::MatrixFill:
+    case Instruction::MatrixAddI64:
+    case Instruction::MatrixAddF64:
+    case Instruction::MatrixScaleI64:
+    case Instruction::MatrixScaleF64:
+        return VariableType::Void;
+    case Instruction::MapPut:
+    case Instruction::AppendToLocalString:
+    case Instruction::AppendToGlobalString:
+    case Instruction::StoreToLocalArrayI64:
+    case Instruction::StoreToGlobalArrayI64:
+    case Instruction::StoreToLocalArrayF64:
+    case Instruction::StoreToGlobalArrayF64:
+    case Instruction::StoreToLocalArrayBool:
+    case Instruction::StoreToGlobalArrayBool:
+    case Instruction::StoreToLocalArrayObject:
+    case Instruction::StoreToGlobalArrayObject:
+    case Instruction::StoreToLocalArrayPacked:
+    case Instruction::StoreToGlobalArrayPacked:
+    case Instruction::StoreToLocalArrayF32:
+    case Instruction::StoreToGlobalArrayF32:
     case Instruction::Jump:
     case Instruction::JumpIfFalse:
+    case Instruction::JumpIfTrue:
+    case Instruction::JumpIfEqualI64:
+    case Instruction::JumpIfNotEqualI64:
+    case Instruction::JumpIfLessI64:
+    case Instruction::JumpIfLessEqualI64:
+    case Instruction::JumpIfGreaterI64:
+    case Instruction::JumpIfGreaterEqualI64:
     case Instruction::Return:
     case Instruction::Invalid:
     case Instruction::Exit:
         return VariableType::Invalid;
     }
 }
+
+void collectIdentifiers(const AbstractSyntaxTree *ast, std::unordered_set<std::string> &identifiers) {
+    if (ast == nullptr) return;
+    switch (ast->nodeType) {
+        case AbstractSyntaxTree::Type::Node: {
+            auto node = dynamic_cast<const Node *>(ast);
+            if (node->token.type == Identifier)
+                identifiers.insert(node->token.value);
+        } break;
+        case AbstractSyntaxTree::Type::BinaryExpression: {
+            auto binaryExpr = dynamic_cast<const BinaryExpression *>(ast);
+            collectIdentifiers(binaryExpr->left, identifiers);
+            collectIdentifiers(binaryExpr->right, identifiers);
+        } break;
+        case AbstractSyntaxTree::Type::UnaryExpression:
+            collectIdentifiers(dynamic_cast<const UnaryExpression *>(ast)->expression, identifiers);
+            break;
+        case AbstractSyntaxTree::Type::Declaration: {
+            auto declaration = dynamic_cast<const Declaration *>(ast);
+            if (declaration->type.has_value())
+                collectIdentifiers(declaration->type.value(), identifiers);
+            if (declaration->value.has_value())
+                collectIdentifiers(declaration->value.value(), identifiers);
+        } break;
+        case AbstractSyntaxTree::Type::ScopedBody:
+            for (auto node: dynamic_cast<const ScopedBody *>(ast)->body)
+                collectIdentifiers(node, identifiers);
+            break;
+        case AbstractSyntaxTree::Type::FunctionDeclaration: {
+            auto functionDeclaration = dynamic_cast<const FunctionDeclaration *>(ast);
+            collectIdentifiers(functionDeclaration->returnType, identifiers);
+            for (auto argument: functionDeclaration->arguments)
+                collectIdentifiers(argument, identifiers);
+        } break;
+        case AbstractSyntaxTree::Type::ReturnStatement:
+            collectIdentifiers(dynamic_cast<const ReturnStatement *>(ast)->expression, identifiers);
+            break;
+        case AbstractSyntaxTree::Type::TypeCast: {
+            auto typeCast = dynamic_cast<const TypeCast *>(ast);
+            collectIdentifiers(typeCast->expression, identifiers);
+            collectIdentifiers(typeCast->type, identifiers);
+        } break;
+        case AbstractSyntaxTree::Type::FunctionCall: {
+            auto call = dynamic_cast<const FunctionCall *>(ast);
+            identifiers.insert(call->identifier.token.value);
+            for (auto argument: call->arguments)
+                collectIdentifiers(argument, identifiers);
+        } break;
+        case AbstractSyntaxTree::Type::IfStatement: {
+            auto ifStatement = dynamic_cast<const IfStatement *>(ast);
+            collectIdentifiers(ifStatement->condition, identifiers);
+            collectIdentifiers(ifStatement->thenBody, identifiers);
+            if (ifStatement->elseBody.has_value())
+                collectIdentifiers(ifStatement->elseBody.value(), identifiers);
+        } break;
+        case AbstractSyntaxTree::Type::WhileStatement: {
+            auto whileStatement = dynamic_cast<const WhileStatement *>(ast);
+            collectIdentifiers(whileStatement->condition, identifiers);
+            collectIdentifiers(whileStatement->body, identifiers);
+        } break;
+        case AbstractSyntaxTree::Type::ForLoop: {
+            auto forLoop = dynamic_cast<const ForLoop *>(ast);
+            collectIdentifiers(forLoop->initialization, identifiers);
+            collectIdentifiers(forLoop->condition, identifiers);
+            collectIdentifiers(forLoop->step, identifiers);
+            collectIdentifiers(forLoop->body, identifiers);
+        } break;
+        case AbstractSyntaxTree::Type::List:
+            for (auto element: dynamic_cast<const List *>(ast)->elements)
+                collectIdentifiers(element, identifiers);
+            break;
+        case AbstractSyntaxTree::Type::ArrayType:
+            collectIdentifiers(dynamic_cast<const ArrayType *>(ast)->type, identifiers);
+            break;
+        case AbstractSyntaxTree::Type::MapType:
+            collectIdentifiers(dynamic_cast<const MapType *>(ast)->keyType, identifiers);
+            collectIdentifiers(dynamic_cast<const MapType *>(ast)->valueType, identifiers);
+            break;
+        case AbstractSyntaxTree::Type::MatrixType: {
+            auto matrixType = dynamic_cast<const MatrixType *>(ast);
+            collectIdentifiers(matrixType->rows, identifiers);
+            collectIdentifiers(matrixType->cols, identifiers);
+        } break;
+        case AbstractSyntaxTree::Type::SoaType:
+            identifiers.insert(dynamic_cast<const SoaType *>(ast)->record.token.value);
+            break;
+        case AbstractSyntaxTree::Type::ArrayAccess: {
+            auto arrayAccess = dynamic_cast<const ArrayAccess *>(ast);
+            identifiers.insert(arrayAccess->identifier.token.value);
+            collectIdentifiers(arrayAccess->index, identifiers);
+        } break;
+        case AbstractSyntaxTree::Type::StructDeclaration:
+            for (auto field: dynamic_cast<const StructDeclaration *>(ast)->fields)
+                collectIdentifiers(field, identifiers);
+            break;
+        case AbstractSyntaxTree::Type::FieldAccess:
+            collectIdentifiers(dynamic_cast<const FieldAccess *>(ast)->object, identifiers);
+            break;
+        case AbstractSyntaxTree::Type::MatrixAccess: {
+            auto matrixAccess = dynamic_cast<const MatrixAccess *>(ast);
+            identifiers.insert(matrixAccess->identifier.token.value);
+            collectIdentifiers(matrixAccess->row, identifiers);
+            collectIdentifiers(matrixAccess->col, identifiers);
+        } break;
+        case AbstractSyntaxTree::Type::ArraySlice: {
+            auto arraySlice = dynamic_cast<const ArraySlice *>(ast);
+            identifiers.insert(arraySlice->identifier.token.value);
+            collectIdentifiers(arraySlice->begin, identifiers);
+            collectIdentifiers(arraySlice->end, identifiers);
+        } break;
+        case AbstractSyntaxTree::Type::ExportStatement:
+            collectIdentifiers(dynamic_cast<const ExportStatement *>(ast)->stm, identifiers);
+            break;
+        case AbstractSyntaxTree::Type::TernaryExpression: {
+            auto ternary = dynamic_cast<const TernaryExpression *>(ast);
+            collectIdentifiers(ternary->condition, identifiers);
+            collectIdentifiers(ternary->thenCase, identifiers);
+            collectIdentifiers(ternary->elseCase, identifiers);
+        } break;
+        case AbstractSyntaxTree::Type::ImportStatement:
+        case AbstractSyntaxTree::Type::Invalid:
+            break;
+    }
+}
@@ -1,4 +1,6 @@
 #include "vm.h"
+#include "kernels.h"
+#include "sort.h"
 #include "utils.h"
 #include <cstdint>
 #include <cstdlib>
@@ -8,6 +10,16 @@
 Program::Program() {
     segments.emplace_back();
 }
+StringObject *Program::intern(std::string_view value) {
+    auto it = strings.find(value);
+    if (it != strings.end())
+        return it->second.get();
+    auto string = makeObject<StringObject>(StringObject::blockSize(value.size()), value.size(), value.data());
+    string->interned = true;
+    string->hashCode();
+    strings.try_emplace(string->view(), string, &free);
+    return string;
+}
 size_t Program::find_global(const std::string &identifier) {
     auto &segment = segments.front();
     auto it = segment.locals.find(identifier);
@@ -25,11 +37,30 @@ Variable Program::find_function(const Segment &segment, const std::string &ident
     return it->second;
 }
 
+void Program::compile_segment(size_t index) {
+    auto segment = segments[index];
+    auto functionBody = segment.body;
+    segment.body = nullptr;
+    functionBody->compile(*this, segment);
+    if (segment.returnType->type == VariableType::Type::Void &&
+        (segment.instructions.empty() || segment.instructions.back().type != Instruction::InstructionType::Return)) {
+        segment.instructions.push_back({
+                .type = Instruction::InstructionType::Return,
+        });
+    }
+    segments[index] = std::move(segment);
+}
+
 void Segment::declare_variable(const std::string &name, VariableType *varType) {
     switch (varType->type) {
         case VariableType::Object:
         case VariableType::NativeLib:
         case VariableType::Array:
+        case VariableType::Map:
+        case VariableType::Matrix:
+        case VariableType::Struct:
+        case VariableType::Soa:
+        case VariableType::CompressedArray:
             locals[name] = Variable(name, varType, number_of_local_ptr);
             number_of_local_ptr++;
             break;
@@ -63,27 +94,31 @@ VM::VM() {
 }
 VM::~VM() {
     free(stack);
-    if (pointersStack == nullptr)
-        return;
-    for (auto i = 0; i < pointersStackSize; i++)
-        delete pointersStack[i];
     free(pointersStack);
+    for (size_t i = 1; i < callStack.size(); i++) {
+        allocator.deallocate(callStack[i].locals, callStack[i].localsSize * sizeof(uint64_t));
+        allocator.deallocate(callStack[i].localPointers, callStack[i].localPointersSize * sizeof(Object *));
+    }
+    free(callStack.front().locals);
+    free(callStack.front().localPointers);
+    sweeper.release(nursery);
+    sweeper.release(tenured);
 }
 inline void VM::newStackFrame(const Segment &segment) {
     uint64_t *locals{};
     Object **pointers{};
     if (segment.number_of_locals != 0) {
-        locals = (uint64_t *) malloc(segment.number_of_locals * sizeof(uint64_t));
+        locals = (uint64_t *) allocator.allocate(segment.number_of_locals * sizeof(uint64_t));
         if (locals == nullptr) {
             throw std::runtime_error("Memory allocation failure!");
         }
     }
     if (segment.number_of_local_ptr != 0) {
-        pointers = (Object **) malloc(segment.number_of_local_ptr * sizeof(Object *));
-        memset(pointers, 0, segment.number_of_local_ptr * sizeof(Object *));
+        pointers = (Object **) allocator.allocate(segment.number_of_local_ptr * sizeof(Object *));
         if (pointers == nullptr) {
             throw std::runtime_error("Memory allocation failure!");
         }
+        memset(pointers, 0, segment.number_of_local_ptr * sizeof(Object *));
     }
     callStack.push_back({
             .locals = locals,
@@ -92,6 +127,7 @@ inline void VM::newStackFrame(const Segment &segment) {
             .localPointersSize = segment.number_of_local_ptr,
             .segmentIndex = segment.id,
             .currentInstruction = 0,
+            .dirty = true,
     });
     for (size_t i = segment.number_of_args - 1; i != -1; i--)
         setLocal(i, popStack());
@@ -99,8 +135,9 @@ inline void VM::newStackFrame(const Segment &segment) {
         setPointer(i, popPointer());
 }
 inline void VM::popStackFrame() {
-    free(callStack.back().locals);
-    free(callStack.back().localPointers);
+    auto &frame = callStack.back();
+    allocator.deallocate(frame.locals, frame.localsSize * sizeof(uint64_t));
+    allocator.deallocate(frame.localPointers, frame.localPointersSize * sizeof(Object *));
     callStack.pop_back();
 }
 inline uint64_t VM::getLocal(const size_t index) const {
@@ -137,12 +174,14 @@ Object *VM::getPointer(size_t index) const {
 }
 void VM::setPointer(size_t index, Object *object) {
     callStack.back().localPointers[index] = object;
+    callStack.back().dirty = true;
 }
 Object *VM::getGlobalPointer(size_t index) const {
     return callStack.front().localPointers[index];
 }
 void VM::setGlobalPointer(size_t index, Object *object) {
     callStack.front().localPointers[index] = object;
+    callStack.front().dirty = true;
 }
 void VM::pushPointer(Object *obj) {
     if (pointersStackSize + 1 > pointersStackCapacity) {
@@ -161,35 +200,7 @@ Object *VM::popPointer() {
 Object *VM::topPointer() const {
     return pointersStack[pointersStackSize - 1];
 }
-void VM::addObject(Object *obj) {
-    objects.push_back(obj);
-    if (objects.size() > gcLimit) {
-        markAll();
-        sweep();
-    }
-}
-void VM::markAll() {
-    for (size_t i = 0; i < pointersStackSize; i++)
-        pointersStack[i]->marked = true;
-    for (auto stackFrame: callStack) {
-        for (size_t i = 0; i < stackFrame.localPointersSize; i++) {
-            if (stackFrame.localPointers[i] != nullptr)
-                stackFrame.localPointers[i]->marked = true;
-        }
-    }
-}
-void VM::sweep() {
-    std::erase_if(objects, [](Object *obj) {
-        if (!obj->marked) {
-            delete obj;
-            return true;
-        } else {
-            obj->marked = false;
-            return false;
-        }
-    });
-}
-void VM::run(const Program &program) {
+void VM::run(Program &program) {
     if (callStack.front().localsSize != program.segments.front().number_of_locals) {
         callStack.front().localsSize = program.segments.front().number_of_locals;
         auto *newPtr = (uint64_t *) realloc(callStack.front().locals, callStack.front().localsSize * sizeof(uint64_t));
@@ -200,16 +211,25 @@ void VM::run(const Program &program) {
         }
     }
     if (callStack.front().localPointersSize != program.segments.front().number_of_local_ptr) {
+        auto oldSize = callStack.front().localPointersSize;
         callStack.front().localPointersSize = program.segments.front().number_of_local_ptr;
         auto *newPtr = (Object **) realloc(callStack.front().localPointers, callStack.front().localPointersSize * sizeof(Object *));
         if (newPtr == nullptr) {
             throw std::runtime_error("Memory allocation failure!");
         } else {
             callStack.front().localPointers = newPtr;
+            memset(newPtr + oldSize, 0, (callStack.front().localPointersSize - oldSize) * sizeof(Object *));
         }
     }
     auto *segment = &program.segments[callStack.back().segmentIndex];
     for (;;) {
+        if (--gcCountdown == 0) {
+            gcCountdown = gcStepInterval;
+            if (shouldStartMajorCycle())
+                startMajorCycle();
+            if (gcPhase != GCPhase::Idle)
+                majorStep();
+        }
         auto &instruction = segment->instructions[callStack.back().currentInstruction];
         switch (instruction.type) {
             case Instruction::InstructionType::Invalid:
@@ -220,9 +240,12 @@ void VM::run(const Program &program) {
                 continue;
             }
             case Instruction::InstructionType::Call: {
+                auto index = instruction.params.index;
+                if (program.segments[index].body != nullptr)
+                    program.compile_segment(index);
                 callStack.back().currentInstruction++;
-                newStackFrame(program.segments[instruction.params.index]);
-                segment = &program.segments[instruction.params.index];
+                newStackFrame(program.segments[index]);
+                segment = &program.segments[index];
                 continue;
             }
             case Instruction::InstructionType::JumpIfFalse: {
@@ -232,6 +255,61 @@ void VM::run(const Program &program) {
                     continue;
                 }
             } break;
+            case Instruction::InstructionType::JumpIfTrue: {
+                auto cond = popStack();
+                if (cond != 0) {
+                    callStack.back().currentInstruction = instruction.params.index;
+                    continue;
+                }
+            } break;
+            case Instruction::JumpIfEqualI64: {
+                auto b = (int64_t) popStack();
+                auto a = (int64_t) popStack();
+                if (a == b) {
+                    callStack.back().currentInstruction = instruction.params.index;
+                    continue;
+                }
+            } break;
+            case Instruction::JumpIfNotEqualI64: {
+                auto b = (int64_t) popStack();
+                auto a = (int64_t) popStack();
+                if (a != b) {
+                    callStack.back().currentInstruction = instruction.params.index;
+                    continue;
+                }
+            } break;
+            case Instruction::JumpIfLessI64: {
+                auto b = (int64_t) popStack();
+                auto a = (int64_t) popStack();
+                if (a < b) {
+                    callStack.back().currentInstruction = instruction.params.index;
+                    continue;
+                }
+            } break;
+            case Instruction::JumpIfLessEqualI64: {
+                auto b = (int64_t) popStack();
+                auto a = (int64_t) popStack();
+                if (a <= b) {
+                    callStack.back().currentInstruction = instruction.params.index;
+                    continue;
+                }
+            } break;
+            case Instruction::JumpIfGreaterI64: {
+                auto b = (int64_t) popStack();
+                auto a = (int64_t) popStack();
+                if (a > b) {
+                    callStack.back().currentInstruction = instruction.params.index;
+                    continue;
+                }
+            } break;
+            case Instruction::JumpIfGreaterEqualI64: {
+                auto b = (int64_t) popStack();
+                auto a = (int64_t) popStack();
+                if (a >= b) {
+                    callStack.back().currentInstruction = instruction.params.index;
+                    continue;
+                }
+            } break;
             case Instruction::InstructionType::Jump:
                 callStack.back().currentInstruction = instruction.params.index;
                 continue;
@@ -265,10 +343,12 @@ void VM::run(const Program &program) {
                 auto a = std::bit_cast<double>(popStack());
                 pushStack(std::bit_cast<uint64_t>(a * b));
             } break;
+            // Ints are signed, -1 is split off so INT64_MIN / -1 wraps
+            // instead of trapping
             case Instruction::DivI64: {
-                auto b = popStack();
+                auto b = (int64_t) popStack();
                 auto a = popStack();
-                pushStack(a / b);
+                pushStack(b == -1 ? 0 - a : (int64_t) a / b);
             } break;
             case Instruction::DivF64: {
                 auto b = std::bit_cast<double>(popStack());
@@ -276,13 +356,49 @@ void VM::run(const Program &program) {
                 pushStack(std::bit_cast<uint64_t>(a / b));
             } break;
             case Instruction::ModI64: {
+                auto b = (int64_t) popStack();
+                auto a = (int64_t) popStack();
+                pushStack(b == -1 ? 0 : a % b);
+            } break;
+            case Instruction::BitAndI64: {
                 auto b = popStack();
                 auto a = popStack();
-                pushStack(a % b);
+                pushStack(a & b);
             } break;
-            case Instruction::GreaterI64: {
+            case Instruction::BitOrI64: {
                 auto b = popStack();
                 auto a = popStack();
+                pushStack(a | b);
+            } break;
+            case Instruction::BitXorI64: {
+                auto b = popStack();
+                auto a = popStack();
+                pushStack(a ^ b);
+            } break;
+            case Instruction::BitNotI64:
+                pushStack(~popStack());
+                break;
+            // Shift amounts are taken modulo 64, >> is arithmetic like the
+            // signed ints it applies to
+            case Instruction::ShiftLeftI64: {
+                auto b = popStack();
+                auto a = popStack();
+                pushStack(a << (b & 63));
+            } break;
+            case Instruction::ShiftRightI64: {
+                auto b = popStack();
+                auto a = (int64_t) popStack();
+                pushStack(a >> (b & 63));
+            } break;
+            case Instruction::ShiftLeftConstI64:
+                pushStack(popStack() << instruction.params.index);
+                break;
+            case Instruction::ShiftRightConstI64:
+                pushStack((int64_t) popStack() >> instruction.params.index);
+                break;
+            case Instruction::GreaterI64: {
+                auto b = (int64_t) popStack();
+                auto a = (int64_t) popStack();
                 pushStack(a > b);
             } break;
             case Instruction::GreaterF64: {
@@ -291,8 +407,8 @@ void VM::run(const Program &program) {
                 pushStack(a > b);
             } break;
             case Instruction::LessI64: {
-                auto b = popStack();
-                auto a = popStack();
+                auto b = (int64_t) popStack();
+                auto a = (int64_t) popStack();
                 pushStack(a < b);
             } break;
             case Instruction::LessF64: {
@@ -301,8 +417,8 @@ void VM::run(const Program &program) {
                 pushStack(a < b);
             } break;
             case Instruction::GreaterEqualI64: {
-                auto b = popStack();
-                auto a = popStack();
+                auto b = (int64_t) popStack();
+                auto a = (int64_t) popStack();
                 pushStack(a >= b);
             } break;
             case Instruction::GreaterEqualF64: {
@@ -311,8 +427,8 @@ void VM::run(const Program &program) {
                 pushStack(a >= b);
             } break;
             case Instruction::LessEqualI64: {
-                auto b = popStack();
-                auto a = popStack();
+                auto b = (int64_t) popStack();
+                auto a = (int64_t) popStack();
                 pushStack(a <= b);
             } break;
             case Instruction::LessEqualF64: {
@@ -407,45 +523,653 @@ void VM::run(const Program &program) {
             case Instruction::LoadObject: {
                 pushPointer((Object *) instruction.params.ptr);
             } break;
-            case Instruction::MakeArray: {
-                auto data = (uint64_t *) malloc(instruction.params.index * sizeof(uint64_t));
-                if (data == nullptr) {
-                    throw std::runtime_error("Memory allocation failure!");
+            case Instruction::MakeArrayI64:
+            case Instruction::MakeArrayF64: {
+                auto size = instruction.params.index;
+                auto array = makeArray(size, instruction.type == Instruction::MakeArrayF64
+                                                     ? ArrayObject::ElementType::F64
+                                                     : ArrayObject::ElementType::I64);
+                for (size_t i = size - 1; i != -1; i--)
+                    array->data[i] = popStack();
+                pushPointer(array);
+                addObject(array);
+            } break;
+            case Instruction::MakeArrayBool: {
+                auto size = instruction.params.index;
+                auto array = makeArray(size, ArrayObject::ElementType::Bool);
+                for (size_t i = size - 1; i != -1; i--)
+                    array->set(i, popStack());
+                pushPointer(array);
+                addObject(array);
+            } break;
+            case Instruction::MakeArrayPacked:
+            case Instruction::MakeArrayF32: {
+                auto size = instruction.params.index >> 8;
+                auto array = makeArray(size, (ArrayObject::ElementType) (instruction.params.index & 0xFF));
+                for (size_t i = size - 1; i != -1; i--)
+                    array->set(i, popStack());
+                pushPointer(array);
+                addObject(array);
+            } break;
+            case Instruction::LoadFromLocalArrayPacked:
+            case Instruction::LoadFromLocalArrayF32:
+            case Instruction::LoadFromGlobalArrayPacked:
+            case Instruction::LoadFromGlobalArrayF32: {
+                auto index = popStack();
+                auto local = instruction.type == Instruction::LoadFromLocalArrayPacked ||
+                             instruction.type == Instruction::LoadFromLocalArrayF32;
+                auto array = (ArrayObject *) (local ? getPointer(instruction.params.index)
+                                                    : getGlobalPointer(instruction.params.index));
+                if (index >= array->size) {
+                    throw std::runtime_error("[VM::run] Array index out of bounds!");
                 }
-                for (size_t i = instruction.params.index - 1; i != -1; i--) {
-                    auto val = popStack();
-                    data[i] = val;
+                pushStack(array->get(index));
+            } break;
+            case Instruction::StoreToLocalArrayPacked:
+            case Instruction::StoreToLocalArrayF32:
+            case Instruction::StoreToGlobalArrayPacked:
+            case Instruction::StoreToGlobalArrayF32: {
+                auto index = popStack();
+                auto val = popStack();
+                auto local = instruction.type == Instruction::StoreToLocalArrayPacked ||
+                             instruction.type == Instruction::StoreToLocalArrayF32;
+                auto array = (ArrayObject *) (local ? getPointer(instruction.params.index)
+                                                    : getGlobalPointer(instruction.params.index));
+                if (index >= array->size) {
+                    throw std::runtime_error("[VM::run] Array index out of bounds!");
                 }
-                auto newObject = new ArrayObject(instruction.params.index, data);
-                pushPointer(newObject);
-                addObject(newObject);
+                array->set(index, val);
             } break;
-            case Instruction::LoadFromLocalArray: {
+            case Instruction::Narrow:
+                pushStack(ArrayObject::narrow((ArrayObject::ElementType) instruction.params.index, popStack()));
+                break;
+            case Instruction::LoadFromLocalArrayI64:
+            case Instruction::LoadFromLocalArrayF64: {
                 auto index = popStack();
                 auto array = (ArrayObject *) getPointer(instruction.params.index);
                 if (index >= array->size) {
                     throw std::runtime_error("[VM::run] Array index out of bounds!");
                 }
-                pushStack(array->data[index]);
+                pushStack(array->elements()[index]);
             } break;
-            case Instruction::LoadFromGlobalArray: {
+            case Instruction::LoadFromGlobalArrayI64:
+            case Instruction::LoadFromGlobalArrayF64: {
                 auto index = popStack();
                 auto array = (ArrayObject *) getGlobalPointer(instruction.params.index);
                 if (index >= array->size) {
                     throw std::runtime_error("[VM::run] Array index out of bounds!");
                 }
-                pushStack(array->data[index]);
+                pushStack(array->elements()[index]);
             } break;
-            case Instruction::AppendToArray: {
-                auto array = (ArrayObject *) popPointer();
+            case Instruction::LoadFromLocalArrayBool: {
+                auto index = popStack();
+                auto array = (ArrayObject *) getPointer(instruction.params.index);
+                if (index >= array->size) {
+                    throw std::runtime_error("[VM::run] Array index out of bounds!");
+                }
+                pushStack(array->get(index));
+            } break;
+            case Instruction::LoadFromGlobalArrayBool: {
+                auto index = popStack();
+                auto array = (ArrayObject *) getGlobalPointer(instruction.params.index);
+                if (index >= array->size) {
+                    throw std::runtime_error("[VM::run] Array index out of bounds!");
+                }
+                pushStack(array->get(index));
+            } break;
+            case Instruction::StoreToLocalArrayI64:
+            case Instruction::StoreToLocalArrayF64: {
+                auto index = popStack();
+                auto val = popStack();
+                auto array = (ArrayObject *) getPointer(instruction.params.index);
+                if (index >= array->size) {
+                    throw std::runtime_error("[VM::run] Array index out of bounds!");
+                }
+                array->elements()[index] = val;
+            } break;
+            case Instruction::StoreToGlobalArrayI64:
+            case Instruction::StoreToGlobalArrayF64: {
+                auto index = popStack();
                 auto val = popStack();
-                auto data = (uint64_t *) realloc(array->data, (array->size + 1) * sizeof(uint64_t));
-                if (data == nullptr) {
-                    throw std::runtime_error("Memory allocation failure!");
+                auto array = (ArrayObject *) getGlobalPointer(instruction.params.index);
+                if (index >= array->size) {
+                    throw std::runtime_error("[VM::run] Array index out of bounds!");
                 }
-                array->data = data;
-                array->data[array->size++] = val;
+                array->elements()[index] = val;
+            } break;
+            case Instruction::StoreToLocalArrayBool: {
+                auto index = popStack();
+                auto val = popStack();
+                auto array = (ArrayObject *) getPointer(instruction.params.index);
+                if (index >= array->size) {
+                    throw std::runtime_error("[VM::run] Array index out of bounds!");
+                }
+                array->set(index, val);
+            } break;
+            case Instruction::StoreToGlobalArrayBool: {
+                auto index = popStack();
+                auto val = popStack();
+                auto array = (ArrayObject *) getGlobalPointer(instruction.params.index);
+                if (index >= array->size) {
+                    throw std::runtime_error("[VM::run] Array index out of bounds!");
+                }
+                array->set(index, val);
+            } break;
+            case Instruction::AppendToArrayI64:
+            case Instruction::AppendToArrayF64:
+            case Instruction::AppendToArrayBool:
+            case Instruction::AppendToArrayPacked:
+            case Instruction::AppendToArrayF32: {
+                auto array = (ArrayObject *) popPointer();
+                appendToArray(array, popStack());
+                pushPointer(array);
+            } break;
+            case Instruction::MakeArrayObject: {
+                auto size = instruction.params.index;
+                auto array = makeArray(size, ArrayObject::ElementType::Object);
+                for (size_t i = size - 1; i != -1; i--)
+                    array->data[i] = std::bit_cast<uint64_t>(popPointer());
                 pushPointer(array);
+                addObject(array);
+            } break;
+            case Instruction::LoadFromLocalArrayObject:
+            case Instruction::LoadFromGlobalArrayObject: {
+                auto index = popStack();
+                auto array = (ArrayObject *) (instruction.type == Instruction::LoadFromLocalArrayObject
+                                                      ? getPointer(instruction.params.index)
+                                                      : getGlobalPointer(instruction.params.index));
+                if (index >= array->size) {
+                    throw std::runtime_error("[VM::run] Array index out of bounds!");
+                }
+                pushPointer((Object *) array->elements()[index]);
+            } break;
+            case Instruction::StoreToLocalArrayObject:
+            case Instruction::StoreToGlobalArrayObject: {
+                auto index = popStack();
+                auto val = popPointer();
+                auto array = (ArrayObject *) (instruction.type == Instruction::StoreToLocalArrayObject
+                                                      ? getPointer(instruction.params.index)
+                                                      : getGlobalPointer(instruction.params.index));
+                if (index >= array->size) {
+                    throw std::runtime_error("[VM::run] Array index out of bounds!");
+                }
+                array->elements()[index] = std::bit_cast<uint64_t>(val);
+                writeBarrier(array->parent != nullptr ? array->parent : array);
+            } break;
+            case Instruction::AppendToArrayObject: {
+                auto array = (ArrayObject *) popPointer();
+                appendToArray(array, std::bit_cast<uint64_t>(popPointer()));
+                pushPointer(array);
+            } break;
+            case Instruction::SliceArray: {
+                auto end = popStack();
+                auto begin = popStack();
+                auto array = (ArrayObject *) popPointer();
+                if (begin > end || end > array->size) {
+                    throw std::runtime_error("[VM::run] Array slice out of bounds!");
+                }
+                auto slice = sliceArray(array, begin, end);
+                pushPointer(slice);
+                addObject(slice);
+            } break;
+            case Instruction::ReserveArray: {
+                auto capacity = popStack();
+                auto array = (ArrayObject *) popPointer();
+                if (capacity > array->capacity)
+                    resizeArray(array, capacity);
+            } break;
+            case Instruction::ShrinkArray: {
+                auto array = (ArrayObject *) popPointer();
+                if (array->capacity > array->size)
+                    resizeArray(array, array->size);
+            } break;
+            case Instruction::EqualString:
+            case Instruction::NotEqualString: {
+                auto b = (StringObject *) popPointer();
+                auto a = (StringObject *) popPointer();
+                pushStack((*a == *b) == (instruction.type == Instruction::EqualString));
+            } break;
+            case Instruction::InternString: {
+                auto string = (StringObject *) popPointer();
+                pushPointer(string->interned ? string : program.intern(string->view()));
+            } break;
+            case Instruction::ConcatString: {
+                auto right = (StringObject *) popPointer();
+                auto left = (StringObject *) popPointer();
+                auto string = concatStrings(left, right, 0);
+                pushPointer(string);
+                addObject(string);
+            } break;
+            case Instruction::StringLength: {
+                auto string = (StringObject *) popPointer();
+                pushStack(string->length);
+            } break;
+            case Instruction::LoadStringChar: {
+                auto index = popStack();
+                auto string = (StringObject *) popPointer();
+                if (index >= string->length)
+                    throw std::runtime_error("[VM::run] String index out of bounds!");
+                pushStack((unsigned char) string->chars[index]);
+            } break;
+            case Instruction::AppendToLocalString:
+            case Instruction::AppendToGlobalString: {
+                auto piece = (StringObject *) popPointer();
+                auto isLocal = instruction.type == Instruction::AppendToLocalString;
+                auto index = instruction.params.index;
+                auto string = (StringObject *) (isLocal ? getPointer(index) : getGlobalPointer(index));
+                if (string->builder && string->capacity - string->length >= piece->length) {
+                    string->append(piece->chars, piece->length);
+                    break;
+                }
+                // Either shared or full: the variable gets a fresh builder
+                // with room to double, so appends stay amortized O(1)
+                auto grown = concatStrings(string, piece, std::max<size_t>(16, 2 * (string->length + piece->length)));
+                grown->builder = true;
+                if (isLocal)
+                    setPointer(index, grown);
+                else
+                    setGlobalPointer(index, grown);
+                addObject(grown);
+            } break;
+            case Instruction::FreezeString: {
+                auto string = (StringObject *) topPointer();
+                string->builder = false;
+            } break;
+            case Instruction::MakeMap: {
+                auto map = newObject<MapObject>(sizeof(MapObject),
+                                                MapObject::keyTypeOf(instruction.params.index),
+                                                MapObject::valueTypeOf(instruction.params.index));
+                pushPointer(map);
+                addObject(map);
+            } break;
+            case Instruction::MapPut: {
+                auto objectValue = MapObject::isObjectType(MapObject::valueTypeOf(instruction.params.index));
+                auto stringKey = MapObject::keyTypeOf(instruction.params.index) == VariableType::Object;
+                auto value = objectValue ? std::bit_cast<uint64_t>(popPointer()) : popStack();
+                auto key = stringKey ? std::bit_cast<uint64_t>(popPointer()) : popStack();
+                auto map = (MapObject *) popPointer();
+                auto slot = map->find(key);
+                if (slot == MapObject::npos) {
+                    if (map->growthLeft == 0)
+                        resizeMap(map, MapObject::capacityFor(2 * (map->size + 1)));
+                    slot = map->insert(key);
+                }
+                map->values[slot] = value;
+                if (stringKey || objectValue)
+                    writeBarrier(map);
+            } break;
+            case Instruction::MapGet:
+            case Instruction::MapContains:
+            case Instruction::MapRemove: {
+                auto stringKey = MapObject::keyTypeOf(instruction.params.index) == VariableType::Object;
+                auto key = stringKey ? std::bit_cast<uint64_t>(popPointer()) : popStack();
+                auto map = (MapObject *) popPointer();
+                auto slot = map->find(key);
+                if (instruction.type == Instruction::MapContains) {
+                    pushStack(slot != MapObject::npos);
+                } else if (instruction.type == Instruction::MapRemove) {
+                    if (slot != MapObject::npos)
+                        map->erase(slot);
+                    pushStack(slot != MapObject::npos);
+                } else if (slot == MapObject::npos) {
+                    throw std::runtime_error("[VM::run] Key not found in map!");
+                } else if (map->objectValues()) {
+                    pushPointer((Object *) map->values[slot]);
+                } else {
+                    pushStack(map->values[slot]);
+                }
+            } break;
+            case Instruction::MapSize: {
+                auto map = (MapObject *) popPointer();
+                pushStack(map->size);
+            } break;
+            case Instruction::ReserveMap: {
+                auto count = popStack();
+                auto map = (MapObject *) popPointer();
+                auto capacity = MapObject::capacityFor(count);
+                if (capacity > map->capacity)
+                    resizeMap(map, capacity);
+            } break;
+            case Instruction::ArrayLength: {
+                auto array = (ArrayObject *) popPointer();
+                pushStack(array->size);
+            } break;
+            case Instruction::StringFind:
+            case Instruction::StringContains:
+            case Instruction::StringCount: {
+                auto needle = (StringObject *) popPointer();
+                auto string = (StringObject *) popPointer();
+                if (instruction.type == Instruction::StringCount) {
+                    pushStack(stringCount(string->chars, string->length, needle->chars, needle->length));
+                    break;
+                }
+                auto position = stringFind(string->chars, string->length, needle->chars, needle->length);
+                if (instruction.type == Instruction::StringContains)
+                    pushStack(position != stringNotFound);
+                else
+                    pushStack(position == stringNotFound ? -1 : position);
+            } break;
+            case Instruction::StringStartsWith: {
+                auto prefix = (StringObject *) popPointer();
+                auto string = (StringObject *) popPointer();
+                pushStack(prefix->length <= string->length &&
+                          memcmp(string->chars, prefix->chars, prefix->length) == 0);
+            } break;
+            case Instruction::StringSplit: {
+                auto separator = (StringObject *) popPointer();
+                auto string = (StringObject *) popPointer();
+                splitString(string, separator);
+            } break;
+            case Instruction::MakeMatrix: {
+                auto cols = (int64_t) popStack();
+                auto rows = (int64_t) popStack();
+                if (rows < 0 || cols < 0) {
+                    throw std::runtime_error("[VM::run] Invalid matrix shape!");
+                }
+                auto matrix = makeMatrix(rows, cols, (VariableType::Type) instruction.params.index);
+                pushPointer(matrix);
+                addObject(matrix);
+            } break;
+            case Instruction::LoadMatrixElement: {
+                auto col = popStack();
+                auto row = popStack();
+                auto matrix = (MatrixObject *) popPointer();
+                if (row >= matrix->rows || col >= matrix->cols) {
+                    throw std::runtime_error("[VM::run] Matrix index out of bounds!");
+                }
+                pushStack(matrix->at(row, col));
+            } break;
+            case Instruction::StoreMatrixElement: {
+                auto col = popStack();
+                auto row = popStack();
+                auto matrix = (MatrixObject *) popPointer();
+                auto value = popStack();
+                if (row >= matrix->rows || col >= matrix->cols) {
+                    throw std::runtime_error("[VM::run] Matrix index out of bounds!");
+                }
+                matrix->at(row, col) = value;
+            } break;
+            case Instruction::MatrixRows: {
+                pushStack(((MatrixObject *) popPointer())->rows);
+            } break;
+            case Instruction::MatrixCols: {
+                pushStack(((MatrixObject *) popPointer())->cols);
+            } break;
+            case Instruction::MatrixFill: {
+                auto value = popStack();
+                auto matrix = (MatrixObject *) popPointer();
+                arrayFill(matrix->data(), matrix->size(), value);
+            } break;
+            case Instruction::MatrixTranspose: {
+                auto matrix = (MatrixObject *) popPointer();
+                auto result = makeMatrix(matrix->cols, matrix->rows, matrix->elementType);
+                matrixTranspose(result->data(), matrix->data(), matrix->rows, matrix->cols);
+                pushPointer(result);
+                addObject(result);
+            } break;
+            case Instruction::MatrixAddI64:
+            case Instruction::MatrixAddF64: {
+                auto source = (MatrixObject *) popPointer();
+                auto destination = (MatrixObject *) popPointer();
+                if (destination->rows != source->rows || destination->cols != source->cols) {
+                    throw std::runtime_error("[VM::run] Matrix shapes do not match!");
+                }
+                if (instruction.type == Instruction::MatrixAddI64)
+                    arrayAddI64(destination->data(), source->data(), destination->size());
+                else
+                    arrayAddF64(destination->data(), source->data(), destination->size());
+            } break;
+            case Instruction::MatrixScaleI64: {
+                auto factor = popStack();
+                auto matrix = (MatrixObject *) popPointer();
+                arrayScaleI64(matrix->data(), matrix->size(), factor);
+            } break;
+            case Instruction::MatrixScaleF64: {
+                auto factor = std::bit_cast<double>(popStack());
+                auto matrix = (MatrixObject *) popPointer();
+                arrayScaleF64(matrix->data(), matrix->size(), factor);
+            } break;
+            case Instruction::MatrixSumI64: {
+                auto matrix = (MatrixObject *) popPointer();
+                pushStack(arraySumI64(matrix->data(), matrix->size()));
+            } break;
+            case Instruction::MatrixSumF64: {
+                auto matrix = (MatrixObject *) popPointer();
+                pushStack(std::bit_cast<uint64_t>(arraySumF64(matrix->data(), matrix->size())));
+            } break;
+            case Instruction::MatrixMultiplyI64:
+            case Instruction::MatrixMultiplyF64: {
+                auto right = (MatrixObject *) popPointer();
+                auto left = (MatrixObject *) popPointer();
+                if (left->cols != right->rows) {
+                    throw std::runtime_error("[VM::run] Matrix shapes do not match!");
+                }
+                auto result = makeMatrix(left->rows, right->cols, left->elementType);
+                if (instruction.type == Instruction::MatrixMultiplyI64)
+                    matrixMultiplyI64(result->data(), left->data(), right->data(), left->rows, left->cols, right->cols);
+                else
+                    matrixMultiplyF64(result->data(), left->data(), right->data(), left->rows, left->cols, right->cols);
+                pushPointer(result);
+                addObject(result);
+            } break;
+            case Instruction::MakeStruct: {
+                auto layout = (const StructType *) instruction.params.ptr;
+                auto object = newObject<StructObject>(StructObject::blockSize(layout->fields.size()), layout);
+                auto fields = object->fields();
+                for (size_t slot = layout->fields.size(); slot > layout->pointerFields; slot--)
+                    fields[slot - 1] = popStack();
+                for (size_t slot = layout->pointerFields; slot > 0; slot--)
+                    fields[slot - 1] = std::bit_cast<uint64_t>(popPointer());
+                pushPointer(object);
+                addObject(object);
+            } break;
+            case Instruction::LoadField: {
+                auto object = (StructObject *) popPointer();
+                pushStack(object->fields()[StructObject::slotOf(instruction.params.index)]);
+            } break;
+            case Instruction::LoadObjectField: {
+                auto object = (StructObject *) popPointer();
+                pushPointer((Object *) object->fields()[StructObject::slotOf(instruction.params.index)]);
+            } break;
+            case Instruction::StoreField: {
+                auto object = (StructObject *) popPointer();
+                object->fields()[StructObject::slotOf(instruction.params.index)] = popStack();
+            } break;
+            case Instruction::StoreObjectField: {
+                auto object = (StructObject *) popPointer();
+                object->fields()[StructObject::slotOf(instruction.params.index)] = std::bit_cast<uint64_t>(popPointer());
+                writeBarrier(object);
+            } break;
+            case Instruction::MakeSoa: {
+                auto soa = makeSoa((const StructType *) instruction.params.ptr);
+                pushPointer(soa);
+                addObject(soa);
+            } break;
+            case Instruction::AppendToSoa: {
+                auto soa = (SoaObject *) popPointer();
+                auto layout = soa->layout;
+                auto columns = soa->columns();
+                for (size_t slot = layout->fields.size(); slot > layout->pointerFields; slot--)
+                    appendToArray(columns[slot - 1], popStack());
+                for (size_t slot = layout->pointerFields; slot > 0; slot--)
+                    appendToArray(columns[slot - 1], std::bit_cast<uint64_t>(popPointer()));
+                soa->size++;
+                pushPointer(soa);
+            } break;
+            case Instruction::AppendStructToSoa: {
+                auto soa = (SoaObject *) popPointer();
+                auto object = (StructObject *) popPointer();
+                if (object->layout != soa->layout) {
+                    throw std::runtime_error("[VM::run] Record type does not match!");
+                }
+                for (size_t slot = 0; slot < soa->layout->fields.size(); slot++)
+                    appendToArray(soa->columns()[slot], object->fields()[slot]);
+                soa->size++;
+                pushPointer(soa);
+            } break;
+            case Instruction::LoadSoaField:
+            case Instruction::LoadSoaObjectField: {
+                auto index = popStack();
+                auto soa = (SoaObject *) popPointer();
+                if (index >= soa->size) {
+                    throw std::runtime_error("[VM::run] Array index out of bounds!");
+                }
+                auto value = soa->columns()[StructObject::slotOf(instruction.params.index)]->get(index);
+                if (instruction.type == Instruction::LoadSoaObjectField)
+                    pushPointer((Object *) value);
+                else
+                    pushStack(value);
+            } break;
+            case Instruction::StoreSoaField:
+            case Instruction::StoreSoaObjectField: {
+                auto index = popStack();
+                auto soa = (SoaObject *) popPointer();
+                if (index >= soa->size) {
+                    throw std::runtime_error("[VM::run] Array index out of bounds!");
+                }
+                auto column = soa->columns()[StructObject::slotOf(instruction.params.index)];
+                if (instruction.type == Instruction::StoreSoaObjectField) {
+                    column->set(index, std::bit_cast<uint64_t>(popPointer()));
+                    writeBarrier(column);
+                } else {
+                    column->set(index, popStack());
+                }
+            } break;
+            case Instruction::LoadSoaColumn: {
+                auto soa = (SoaObject *) popPointer();
+                auto column = sliceArray(soa->columns()[instruction.params.index], 0, soa->size);
+                pushPointer(column);
+                addObject(column);
+            } break;
+            case Instruction::LoadSoaRecord: {
+                auto index = popStack();
+                auto soa = (SoaObject *) popPointer();
+                if (index >= soa->size) {
+                    throw std::runtime_error("[VM::run] Array index out of bounds!");
+                }
+                auto layout = soa->layout;
+                auto object = newObject<StructObject>(StructObject::blockSize(layout->fields.size()), layout);
+                for (size_t slot = 0; slot < layout->fields.size(); slot++)
+                    object->fields()[slot] = soa->columns()[slot]->get(index);
+                pushPointer(object);
+                addObject(object);
+            } break;
+            case Instruction::SoaLength:
+                pushStack(((SoaObject *) popPointer())->size);
+                break;
+            case Instruction::CompressArray: {
+                auto compressed = compressArray((ArrayObject *) popPointer());
+                pushPointer(compressed);
+                addObject(compressed);
+            } break;
+            case Instruction::DecompressArray: {
+                auto compressed = (CompressedArrayObject *) popPointer();
+                auto array = makeArray(compressed->size, ArrayObject::ElementType::I64);
+                compressed->decode(array->elements());
+                pushPointer(array);
+                addObject(array);
+            } break;
+            case Instruction::LoadCompressedElement: {
+                auto index = popStack();
+                auto compressed = (CompressedArrayObject *) popPointer();
+                if (index >= compressed->size) {
+                    throw std::runtime_error("[VM::run] Array index out of bounds!");
+                }
+                pushStack(compressed->get(index));
+            } break;
+            case Instruction::CompressedLength:
+                pushStack(((CompressedArrayObject *) popPointer())->size);
+                break;
+            case Instruction::CompressedSum:
+                pushStack(((CompressedArrayObject *) popPointer())->sum());
+                break;
+            case Instruction::ArraySumI64: {
+                auto array = (ArrayObject *) popPointer();
+                pushStack(arraySumI64(array->elements(), array->size));
+            } break;
+            case Instruction::ArraySumF64: {
+                auto array = (ArrayObject *) popPointer();
+                pushStack(std::bit_cast<uint64_t>(arraySumF64(array->elements(), array->size)));
+            } break;
+            case Instruction::ArrayMinI64:
+            case Instruction::ArrayMaxI64: {
+                auto array = (ArrayObject *) popPointer();
+                if (array->size == 0) {
+                    throw std::runtime_error("[VM::run] Empty array has no extreme value!");
+                }
+                pushStack(instruction.type == Instruction::ArrayMinI64 ? arrayMinI64(array->elements(), array->size)
+                                                                       : arrayMaxI64(array->elements(), array->size));
+            } break;
+            case Instruction::ArrayMinF64:
+            case Instruction::ArrayMaxF64: {
+                auto array = (ArrayObject *) popPointer();
+                if (array->size == 0) {
+                    throw std::runtime_error("[VM::run] Empty array has no extreme value!");
+                }
+                pushStack(std::bit_cast<uint64_t>(instruction.type == Instruction::ArrayMinF64
+                                                          ? arrayMinF64(array->elements(), array->size)
+                                                          : arrayMaxF64(array->elements(), array->size)));
+            } break;
+            case Instruction::ArrayDotI64:
+            case Instruction::ArrayDotF64: {
+                auto right = (ArrayObject *) popPointer();
+                auto left = (ArrayObject *) popPointer();
+                if (left->size != right->size) {
+                    throw std::runtime_error("[VM::run] Array sizes do not match!");
+                }
+                pushStack(instruction.type == Instruction::ArrayDotI64
+                                  ? arrayDotI64(left->elements(), right->elements(), left->size)
+                                  : std::bit_cast<uint64_t>(arrayDotF64(left->elements(), right->elements(), left->size)));
+            } break;
+            case Instruction::ArrayScaleI64: {
+                auto factor = popStack();
+                auto array = (ArrayObject *) popPointer();
+                arrayScaleI64(array->elements(), array->size, factor);
+            } break;
+            case Instruction::ArrayScaleF64: {
+                auto factor = std::bit_cast<double>(popStack());
+                auto array = (ArrayObject *) popPointer();
+                arrayScaleF64(array->elements(), array->size, factor);
+            } break;
+            case Instruction::ArrayAddI64:
+            case Instruction::ArrayAddF64: {
+                auto source = (ArrayObject *) popPointer();
+                auto destination = (ArrayObject *) popPointer();
+                if (destination->size != source->size) {
+                    throw std::runtime_error("[VM::run] Array sizes do not match!");
+                }
+                if (instruction.type == Instruction::ArrayAddI64)
+                    arrayAddI64(destination->elements(), source->elements(), destination->size);
+                else
+                    arrayAddF64(destination->elements(), source->elements(), destination->size);
+            } break;
+            case Instruction::ArrayFillI64:
+            case Instruction::ArrayFillF64: {
+                auto value = popStack();
+                auto array = (ArrayObject *) popPointer();
+                arrayFill(array->elements(), array->size, value);
+            } break;
+            case Instruction::ArrayCountEqualI64: {
+                auto value = popStack();
+                auto array = (ArrayObject *) popPointer();
+                pushStack(arrayCountEqualI64(array->elements(), array->size, value));
+            } break;
+            case Instruction::ArrayCountEqualF64: {
+                auto value = std::bit_cast<double>(popStack());
+                auto array = (ArrayObject *) popPointer();
+                pushStack(arrayCountEqualF64(array->elements(), array->size, value));
+            } break;
+            case Instruction::ArraySortI64:
+            case Instruction::ArraySortUnstableI64: {
+                auto array = (ArrayObject *) popPointer();
+                sortI64(array->elements(), array->size, instruction.type == Instruction::ArraySortI64,
+                        sortThreads, sortParallelThreshold);
+            } break;
+            case Instruction::ArraySortF64:
+            case Instruction::ArraySortUnstableF64: {
+                auto array = (ArrayObject *) popPointer();
+                sortF64(array->elements(), array->size, instruction.type == Instruction::ArraySortF64,
+                        sortThreads, sortParallelThreshold);
             } break;
             case Instruction::LoadLib: {
                 loadNativeFunction();
@@ -499,13 +1223,155 @@ void VM::callNativeFunction() {
             break;
     }
 }
+ArrayObject *VM::makeArray(size_t size, ArrayObject::ElementType elementType) {
+    return newObject<ArrayObject>(ArrayObject::blockSize(elementType, size), size, elementType);
+}
+MatrixObject *VM::makeMatrix(size_t rows, size_t cols, VariableType::Type elementType) {
+    if (cols != 0 && rows > (SIZE_MAX - sizeof(MatrixObject)) / sizeof(uint64_t) / cols)
+        throw std::runtime_error("[VM::makeMatrix] Matrix is too large!");
+    return newObject<MatrixObject>(MatrixObject::blockSize(rows, cols), rows, cols, elementType);
+}
+// Views share the elements of the array, offsets count elements so packed
+// formats are viewed through get and set
+ArrayObject *VM::sliceArray(ArrayObject *array, size_t begin, size_t end) {
+    auto root = array->parent != nullptr ? array->parent : array;
+    return newObject<ArrayObject>(sizeof(ArrayObject), root, array->offset + begin, end - begin);
+}
+SoaObject *VM::makeSoa(const StructType *layout) {
+    auto soa = newObject<SoaObject>(SoaObject::blockSize(layout->fields.size()), layout);
+    for (auto &field: layout->fields) {
+        auto column = makeArray(0, storageOf(field.type));
+        soa->columns()[field.slot] = column;
+        addObject(column, false);
+    }
+    return soa;
+}
+CompressedArrayObject *VM::compressArray(const ArrayObject *array) {
+    auto plan = CompressedArrayObject::plan(array->elements(), array->size);
+    auto blockSize = CompressedArrayObject::blockSize(plan.size(), CompressedArrayObject::totalWords(plan));
+    return newObject<CompressedArrayObject>(blockSize, array->elements(), array->size, plan);
+}
+void VM::appendToArray(ArrayObject *array, uint64_t value) {
+    if (array->size == array->capacity) {
+        auto minimum = array->elementType == ArrayObject::ElementType::Bool ? 64 : 4;
+        resizeArray(array, std::max<size_t>(array->capacity * 2, minimum));
+    }
+    array->set(array->size++, value);
+    writeBarrier(array);
+}
+void VM::resizeArray(ArrayObject *array, size_t capacity) {
+    // Rounding adds at most 63 elements of at most a word each
+    if (capacity > (SIZE_MAX - sizeof(ArrayObject)) / sizeof(uint64_t) - 64)
+        throw std::runtime_error("[VM::resizeArray] Array is too large!");
+    capacity = ArrayObject::roundCapacity(array->elementType, capacity);
+    auto bytes = ArrayObject::storageBytes(array->elementType, capacity);
+    auto usedBytes = ArrayObject::storageBytes(array->elementType, array->size);
+    if (array->parent != nullptr) {
+        // Copy-on-write: a view takes its own copy of the elements before it
+        // changes shape, so the parent is never affected
+        capacity = std::max(capacity, array->size);
+        bytes = ArrayObject::storageBytes(array->elementType, capacity);
+        auto data = (uint64_t *) (array->pooled ? allocator.allocate(bytes) : malloc(bytes));
+        if (data == nullptr && bytes != 0)
+            throw std::runtime_error("Memory allocation failure!");
+        auto parent = array->parent;
+        auto offset = array->offset;
+        array->parent = nullptr;
+        array->offset = 0;
+        array->data = data;
+        array->capacity = capacity;
+        if (ArrayObject::wordAligned(array->elementType)) {
+            if (usedBytes != 0)
+                memcpy(data, parent->data + offset, usedBytes);
+        } else {
+            // Packed views need not start on a word, bools are set bit by bit
+            if (bytes != 0)
+                memset(data, 0, bytes);
+            for (size_t i = 0; i < array->size; i++)
+                array->set(i, parent->get(offset + i));
+        }
+        accountGrowth(array, (ptrdiff_t) bytes);
+        return;
+    }
+    auto external = array->ownsExternalStorage();
+    auto oldBytes = external ? ArrayObject::storageBytes(array->elementType, array->capacity) : 0;
+    if (capacity <= array->inlineCapacity) {
+        if (!external) return;
+        memcpy(array->inlineData(), array->data, usedBytes);
+        if (array->pooled)
+            allocator.deallocate(array->data, oldBytes);
+        else
+            free(array->data);
+        array->data = array->inlineData();
+        array->capacity = array->inlineCapacity;
+        accountGrowth(array, -(ptrdiff_t) oldBytes);
+        return;
+    }
+    uint64_t *data;
+    if (!external) {
+        data = (uint64_t *) (array->pooled ? allocator.allocate(bytes) : malloc(bytes));
+        if (data != nullptr)
+            memcpy(data, array->data, usedBytes);
+    } else {
+        data = (uint64_t *) (array->pooled ? allocator.reallocate(array->data, oldBytes, bytes)
+                                           : realloc(array->data, bytes));
+    }
+    if (data == nullptr)
+        throw std::runtime_error("Memory allocation failure!");
+    array->data = data;
+    array->capacity = capacity;
+    accountGrowth(array, (ptrdiff_t) bytes - (ptrdiff_t) oldBytes);
+}
+StringObject *VM::concatStrings(StringObject *left, StringObject *right, size_t capacity) {
+    capacity = std::max(capacity, left->length + right->length);
+    auto string = newObject<StringObject>(StringObject::blockSize(capacity), left->length, left->chars, capacity);
+    string->append(right->chars, right->length);
+    return string;
+}
+void VM::resizeMap(MapObject *map, size_t capacity) {
+    auto bytes = MapObject::storageBytes(capacity);
+    auto oldBytes = MapObject::storageBytes(map->capacity);
+    auto storage = map->pooled ? allocator.allocate(bytes) : malloc(bytes);
+    if (storage == nullptr)
+        throw std::runtime_error("Memory allocation failure!");
+    if (auto old = map->rehash(storage, capacity)) {
+        if (map->pooled)
+            allocator.deallocate(old, oldBytes);
+        else
+            free(old);
+    }
+    accountGrowth(map, (ptrdiff_t) bytes - (ptrdiff_t) oldBytes);
+}
+// Pushes an array of views into string, one per piece between separators.
+// Nothing is linked into the nursery until every piece exists, so no
+// collection can run while the operands are off the stack.
+void VM::splitString(StringObject *string, StringObject *separator) {
+    if (separator->length == 0)
+        throw std::runtime_error("[VM::run] Cannot split on an empty separator!");
+    auto pieces = stringCount(string->chars, string->length, separator->chars, separator->length) + 1;
+    auto array = makeArray(pieces, ArrayObject::ElementType::Object);
+    auto root = string->parent != nullptr ? string->parent : string;
+    size_t offset = 0;
+    for (size_t i = 0; i < pieces; i++) {
+        auto position = i + 1 == pieces ? string->length - offset
+                                        : stringFind(string->chars + offset, string->length - offset,
+                                                     separator->chars, separator->length);
+        auto piece = newObject<StringObject>(StringObject::blockSize(0), root, string->chars + offset, position);
+        array->data[i] = std::bit_cast<uint64_t>(piece);
+        addObject(piece, false);
+        offset += position + separator->length;
+    }
+    pushPointer(array);
+    addObject(array);
+}
 void VM::loadNativeFunction() {
     auto libPath = (StringObject *) popPointer();
-    auto handle = dlopen(libPath->chars, RTLD_LAZY);
+    auto path = std::string(libPath->view());
+    auto handle = dlopen(path.c_str(), RTLD_LAZY);
     if (handle == nullptr) {
-        throw std::runtime_error("Object file not found: " + std::string(libPath->chars));
+        throw std::runtime_error("Object file not found: " + path);
     }
-    auto lib = new DynamicLibObject(libPath->chars, handle);
+    auto lib = newObject<DynamicLibObject>(sizeof(DynamicLibObject), libPath->chars, handle);
     pushPointer(lib);
     addObject(lib);
 }
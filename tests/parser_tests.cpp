@@ -46,6 +46,55 @@ TEST(ParserTests, CompoundBinaryExpression) {
     deleteAST(expectedResult);
 }
 
+TEST(ParserTests, BitwisePrecedence) {
+    const char *input = "~a & b >> 2 == c | 1;";
+    auto expectedResult = std::vector<AbstractSyntaxTree *>{
+            new BinaryExpression(
+                    new BinaryExpression(
+                            new UnaryExpression(new Node({Identifier, "a"}), {BitNot, "~"}, UnaryExpression::Side::LEFT),
+                            new BinaryExpression(
+                                    new Node({Identifier, "b"}),
+                                    new Node({Number, "2"}),
+                                    {ShiftRight, ">>"}),
+                            {BitAnd, "&"}),
+                    new BinaryExpression(
+                            new Node({Identifier, "c"}),
+                            new Node({Number, "1"}),
+                            {BitOr, "|"}),
+                    {Equal, "=="}),
+    };
+    auto actualResult = parse(input);
+
+    ASSERT_EQ(expectedResult.size(), actualResult.size());
+    for (int i = 0; i < expectedResult.size(); i++)
+        ASSERT_EQ(*expectedResult[i], *actualResult[i]);
+    deleteAST(actualResult);
+    deleteAST(expectedResult);
+}
+
+TEST(ParserTests, LogicalPrecedence) {
+    const char *input = "!a || b && c == d;";
+    auto expectedResult = std::vector<AbstractSyntaxTree *>{
+            new BinaryExpression(
+                    new UnaryExpression(new Node({Identifier, "a"}), {Not, "!"}, UnaryExpression::Side::LEFT),
+                    new BinaryExpression(
+                            new Node({Identifier, "b"}),
+                            new BinaryExpression(
+                                    new Node({Identifier, "c"}),
+                                    new Node({Identifier, "d"}),
+                                    {Equal, "=="}),
+                            {And, "&&"}),
+                    {Or, "||"}),
+    };
+    auto actualResult = parse(input);
+
+    ASSERT_EQ(expectedResult.size(), actualResult.size());
+    for (int i = 0; i < expectedResult.size(); i++)
+        ASSERT_EQ(*expectedResult[i], *actualResult[i]);
+    deleteAST(actualResult);
+    deleteAST(expectedResult);
+}
+
 TEST(ParserTests, ParseStrings) {
     const char *input = "x = \"foo\";";
     auto expectedResult = std::vector<AbstractSyntaxTree *>{
@@ -535,6 +584,137 @@ TEST(ParserTests, ArrayAccess) {
     deleteAST(expectedResult);
 }
 
+TEST(ParserTests, ArraySlice) {
+    const char *input = "x[1:n];";
+    auto expectedResult = std::vector<AbstractSyntaxTree *>({
+            new ArraySlice(
+                    Node({Identifier, "x"}),
+                    new Node({Number, "1"}),
+                    new Node({Identifier, "n"})),
+    });
+
+    auto actualResult = parse(input);
+    ASSERT_EQ(expectedResult.size(), actualResult.size());
+    for (int i = 0; i < expectedResult.size(); i++)
+        ASSERT_EQ(*expectedResult[i], *actualResult[i]);
+    deleteAST(actualResult);
+    deleteAST(expectedResult);
+}
+
+TEST(ParserTests, MapDeclaration) {
+    const char *input = "define m : map(str, int);";
+    auto expectedResult = std::vector<AbstractSyntaxTree *>({
+            new Declaration(
+                    new MapType(new Node({Str, "str"}), new Node({Int, "int"})),
+                    Node({Identifier, "m"})),
+    });
+
+    auto actualResult = parse(input);
+    ASSERT_EQ(expectedResult.size(), actualResult.size());
+    for (int i = 0; i < expectedResult.size(); i++)
+        ASSERT_EQ(*expectedResult[i], *actualResult[i]);
+    deleteAST(actualResult);
+    deleteAST(expectedResult);
+}
+
+TEST(ParserTests, MatrixDeclarationAndAccess) {
+    const char *input = "define m : float[2, 3];"
+                        "m[1, 2] = 4;";
+    auto expectedResult = std::vector<AbstractSyntaxTree *>({
+            new Declaration(
+                    new MatrixType(new Node({Float, "float"}), new Node({Number, "2"}), new Node({Number, "3"})),
+                    Node({Identifier, "m"})),
+            new BinaryExpression(
+                    new MatrixAccess(Node({Identifier, "m"}), new Node({Number, "1"}), new Node({Number, "2"})),
+                    new Node({Number, "4"}),
+                    {Assign, "="}),
+    });
+
+    auto actualResult = parse(input);
+    ASSERT_EQ(expectedResult.size(), actualResult.size());
+    for (int i = 0; i < expectedResult.size(); i++)
+        ASSERT_EQ(*expectedResult[i], *actualResult[i]);
+    deleteAST(actualResult);
+    deleteAST(expectedResult);
+}
+
+TEST(ParserTests, StructDeclarationAndFieldAccess) {
+    const char *input = "define Point : struct(x: int, y: float);"
+                        "p.x = q.next.y;";
+    auto expectedResult = std::vector<AbstractSyntaxTree *>({
+            new Declaration(
+                    new StructDeclaration({
+                            new Declaration(new Node({Int, "int"}), Node({Identifier, "x"})),
+                            new Declaration(new Node({Float, "float"}), Node({Identifier, "y"})),
+                    }),
+                    Node({Identifier, "Point"})),
+            new BinaryExpression(
+                    new FieldAccess(new Node({Identifier, "p"}), Node({Identifier, "x"})),
+                    new FieldAccess(new FieldAccess(new Node({Identifier, "q"}), Node({Identifier, "next"})),
+                                    Node({Identifier, "y"})),
+                    {Assign, "="}),
+    });
+
+    auto actualResult = parse(input);
+    ASSERT_EQ(expectedResult.size(), actualResult.size());
+    for (int i = 0; i < expectedResult.size(); i++)
+        ASSERT_EQ(*expectedResult[i], *actualResult[i]);
+    deleteAST(actualResult);
+    deleteAST(expectedResult);
+}
+
+TEST(ParserTests, SoaDeclarationAndColumnAccess) {
+    const char *input = "define ps : soa(Point);"
+                        "ps[i].x = 1;";
+    auto expectedResult = std::vector<AbstractSyntaxTree *>({
+            new Declaration(new SoaType(Node({Identifier, "Point"})), Node({Identifier, "ps"})),
+            new BinaryExpression(
+                    new FieldAccess(new ArrayAccess(Node({Identifier, "ps"}), new Node({Identifier, "i"})),
+                                    Node({Identifier, "x"})),
+                    new Node({Number, "1"}),
+                    {Assign, "="}),
+    });
+
+    auto actualResult = parse(input);
+    ASSERT_EQ(expectedResult.size(), actualResult.size());
+    for (int i = 0; i < expectedResult.size(); i++)
+        ASSERT_EQ(*expectedResult[i], *actualResult[i]);
+    deleteAST(actualResult);
+    deleteAST(expectedResult);
+}
+
+TEST(ParserTests, FixedWidthTypes) {
+    const char *input = "define ids : u8[];"
+                        "define w : f32 = (f32) x;";
+    auto expectedResult = std::vector<AbstractSyntaxTree *>({
+            new Declaration(new ArrayType(new Node({UInt8, "u8"})), Node({Identifier, "ids"})),
+            new Declaration(new Node({Float32, "f32"}), Node({Identifier, "w"}),
+                            new TypeCast(new Node({Identifier, "x"}), new Node({Float32, "f32"}))),
+    });
+
+    auto actualResult = parse(input);
+    ASSERT_EQ(expectedResult.size(), actualResult.size());
+    for (int i = 0; i < expectedResult.size(); i++)
+        ASSERT_EQ(*expectedResult[i], *actualResult[i]);
+    deleteAST(actualResult);
+    deleteAST(expectedResult);
+}
+
+TEST(ParserTests, CompressedType) {
+    const char *input = "define ids : compressed = compress(raw);";
+    auto expectedResult = std::vector<AbstractSyntaxTree *>({
+            new Declaration(new Node({Compressed, "compressed"}), Node({Identifier, "ids"}),
+                            new FunctionCall(Node({Identifier, "compress"}), {new Node({Identifier, "raw"})})),
+    });
+
+    auto actualResult = parse(input);
+    ASSERT_EQ(expectedResult.size(), actualResult.size());
+    for (int i = 0; i < expectedResult.size(); i++)
+        ASSERT_EQ(*expectedResult[i], *actualResult[i]);
+    deleteAST(actualResult);
+    deleteAST(expectedResult);
+}
+
 TEST(ParserTests, NestedScopes) {
     const char *input =
             "define fun : function(x : int) -> int = {"
@@ -1,4 +1,6 @@
 #include "ast.h"
+#include <filesystem>
+#include <fstream>
 #include <gtest/gtest.h>
 #include <vector>
 
@@ -175,6 +177,86 @@ TEST(VM, SimpleIfElseCondition) {
     ASSERT_EQ(vm.topStack(), 43);
 }
 
+TEST(VM, IfElseTakesThenBranch) {
+    const char *input = "define a : int = 69;"
+                        "if 0 < 10 { a = 42; } else { a = 43; };"
+                        "a + 1;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 43);
+}
+
+TEST(VM, LogicalOperators) {
+    const std::vector<std::pair<const char *, int64_t>> cases = {
+            {"true && false;", 0},
+            {"false || true;", 1},
+            {"!false;", 1},
+            {"define x = 5; x > 3 && x < 10;", 1},
+            {"define x = 0 - 5; x < 0;", 1},
+            {"define x = 0 - 5; define r = 0; if x < 0 || x > 100 { r = 1; }; r;", 1},
+            {"define x = 50; define out = x < 0 || x > 100; define r = 0; if !out && x != 7 { r = 1; } else { r = 2; }; r;", 1},
+            {"define b = true; define r = 0; if !b { r = 1; } else { r = 2; }; r;", 2},
+            {"define x = 3; define r = x > 2 && x != 4 ? 10 : 20; r;", 10},
+    };
+    for (auto &[input, expected]: cases) {
+        VM vm;
+        auto program = compile(input);
+        vm.run(program);
+        ASSERT_EQ((int64_t) vm.topStack(), expected) << input;
+    }
+    EXPECT_THROW(compile("1 && true;"), std::runtime_error);
+}
+
+TEST(VM, TypedBoolVariables) {
+    const char *input = "define pick : function(flag: bool, x: int) -> int = {"
+                        "    define done : bool = false;"
+                        "    define steps = 0;"
+                        "    while !done {"
+                        "        steps++;"
+                        "        done = steps == x;"
+                        "    };"
+                        "    define hit : bool = flag && x > 2;"
+                        "    return hit ? steps : 0 - steps;"
+                        "};"
+                        "define on : bool = true;"
+                        "pick(on, 4) + pick(!on, 3) * 10;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ((int64_t) vm.topStack(), 4 - 30);
+    EXPECT_THROW(compile("define b : bool = 1;"), std::runtime_error);
+}
+
+TEST(VM, ShortCircuitSkipsRightOperand) {
+    const char *input = "define calls = 0;"
+                        "define touch : function() -> bool = { calls++; return true; };"
+                        "define a = false && touch();"
+                        "define b = true || touch();"
+                        "if 1 > 2 && touch() { calls = 100; };"
+                        "while false && touch() { calls = 100; };"
+                        "define c = true && touch();"
+                        "calls;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 1);
+}
+
+TEST(VM, ComparisonsBranchDirectly) {
+    auto program = compile("define n = 0;"
+                           "for define i = 0; i < 10 && n != 7; i++ { n += 1; };"
+                           "n;");
+    for (auto &instruction: program.segments[0].instructions) {
+        ASSERT_NE(instruction.type, Instruction::LessI64);
+        ASSERT_NE(instruction.type, Instruction::NotEqualI64);
+        ASSERT_NE(instruction.type, Instruction::JumpIfFalse);
+    }
+    VM vm;
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 7);
+}
+
 TEST(VM, SimpleFunctionDeclaration) {
     const char *input = "define add : function(x: int, y: int) -> int = { return x + y; };"
                         "add(1, 2);";
@@ -193,6 +275,27 @@ TEST(VM, RecursiveFunction) {
     ASSERT_EQ(vm.topStack(), 55);
 }
 
+TEST(VM, UncalledFunctionBodiesAreNotCompiled) {
+    const char *input = "define unused : function() -> int = { return undefined_variable; };"
+                        "42;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 42);
+    ASSERT_NE(program.segments[1].body, nullptr);
+}
+
+TEST(VM, FunctionBodiesAreCompiledOnFirstCall) {
+    const char *input = "define square : function(x: int) -> int = { return x * x; };"
+                        "square(3) + square(4);";
+    VM vm;
+    auto program = compile(input);
+    ASSERT_TRUE(program.segments[1].instructions.empty());
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 25);
+    ASSERT_EQ(program.segments[1].body, nullptr);
+}
+
 TEST(VM, SimpleWhileLoop) {
     const char *input = "define a : int = 0;"
                         "while a < 10 { a = a + 1; };"
@@ -255,6 +358,512 @@ TEST(VM, AppendToArray) {
     ASSERT_EQ(*obj, std::vector<uint64_t>({1, 2, 3, 4, 5}));
 }
 
+TEST(VM, LiveArraysSurviveCollections) {
+    const char *input = "define keep : int[] = [1, 2, 3];"
+                        "define tmp : int[] = [];"
+                        "define fill : function(n: int) -> void = {"
+                        "    define local : int[] = [n];"
+                        "    for define i = 0; i < n; i++ { tmp = [i, i]; };"
+                        "    keep += local[0];"
+                        "};"
+                        "fill(5000);"
+                        "for define i = 0; i < 5000; i++ { tmp = [i]; };"
+                        "keep;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    auto obj = (ArrayObject *) vm.topPointer();
+    ASSERT_EQ(*obj, std::vector<uint64_t>({1, 2, 3, 5000}));
+}
+
+TEST(VM, ArraysGrowAcrossSizeClasses) {
+    const char *input = "define arr : int[] = [];"
+                        "for define i = 0; i < 1000; i++ { arr += i; };"
+                        "arr;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    auto obj = (ArrayObject *) vm.topPointer();
+    std::vector<uint64_t> expected(1000);
+    for (size_t i = 0; i < expected.size(); i++)
+        expected[i] = i;
+    ASSERT_EQ(*obj, expected);
+}
+
+TEST(VM, ArrayAppendGrowsGeometrically) {
+    const char *input = "define arr : int[] = [];"
+                        "for define i = 0; i < 5; i++ { arr += i; };"
+                        "arr;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    auto obj = (ArrayObject *) vm.topPointer();
+    ASSERT_EQ(*obj, std::vector<uint64_t>({0, 1, 2, 3, 4}));
+    ASSERT_EQ(obj->capacity, 8);
+}
+
+TEST(VM, ReserveArrayCapacity) {
+    const char *input = "define arr : int[] = [7];"
+                        "reserve(arr, 100);"
+                        "for define i = 0; i < 50; i++ { arr += i; };"
+                        "arr;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    auto obj = (ArrayObject *) vm.topPointer();
+    ASSERT_EQ(obj->size, 51);
+    ASSERT_EQ(obj->capacity, 100);
+    ASSERT_EQ(obj->data[0], 7);
+    ASSERT_EQ(obj->data[50], 49);
+}
+
+TEST(VM, ReserveRejectsOverflowingCapacity) {
+    for (auto input : {"define arr : int[] = [1]; reserve(arr, 2305843009213693953);",
+                       "define arr : int[] = [1]; reserve(arr, 0 - 1);",
+                       "define flags : bool[] = [true]; reserve(flags, 0 - 1);",
+                       "define bytes : i8[] = [1]; reserve(bytes, 0 - 1);"}) {
+        VM vm;
+        auto program = compile(input);
+        EXPECT_THROW(vm.run(program), std::runtime_error) << input;
+    }
+}
+
+TEST(VM, ShrinkArrayToFit) {
+    const char *input = "define arr : int[] = [1, 2, 3];"
+                        "arr += 4;"
+                        "define small : int[] = [1, 2, 3];"
+                        "reserve(small, 64);"
+                        "shrink(small);"
+                        "shrink(arr);"
+                        "small;"
+                        "arr;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    auto arr = (ArrayObject *) vm.popPointer();
+    ASSERT_EQ(*arr, std::vector<uint64_t>({1, 2, 3, 4}));
+    ASSERT_EQ(arr->capacity, 4);
+    auto small = (ArrayObject *) vm.popPointer();
+    ASSERT_EQ(*small, std::vector<uint64_t>({1, 2, 3}));
+    ASSERT_EQ(small->data, small->inlineData());
+}
+
+TEST(VM, BoolArraysArePacked) {
+    const char *input = "define flags : bool[] = [true, false, true];"
+                        "for define i = 0; i < 100; i++ { flags += i % 3 == 0; };"
+                        "flags[1] = true;"
+                        "flags;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    auto obj = (ArrayObject *) vm.topPointer();
+    ASSERT_EQ(obj->elementType, ArrayObject::ElementType::Bool);
+    ASSERT_EQ(obj->size, 103);
+    ASSERT_EQ(obj->capacity, 128);
+    ASSERT_EQ(obj->data[0], 0b111 | 0x9249249249249248ull);
+    ASSERT_EQ(obj->get(102), 1);
+    ASSERT_EQ(obj->get(101), 0);
+}
+
+TEST(VM, LoadFromBoolArray) {
+    const char *input = "define flags : bool[] = [false, true];"
+                        "define count : function(arr: bool[]) -> int = {"
+                        "    define total = 0;"
+                        "    for define i = 0; i < 2; i++ { if arr[i] { total++; }; };"
+                        "    return total;"
+                        "};"
+                        "count(flags) + count([true, true]);";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 3);
+}
+
+TEST(VM, FloatArraysStoreDoubles) {
+    const char *input = "define values : float[] = [1, 2.5];"
+                        "values += 4;"
+                        "values[0] = values[1] * 2;"
+                        "values[0] + values[2];";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(std::bit_cast<double>(vm.topStack()), 9.0);
+}
+
+TEST(VM, StoreToArrayElement) {
+    const char *input = "define arr : int[] = [1, 2, 3];"
+                        "define set : function(i: int, v: int) -> void = {"
+                        "    arr[i] = v;"
+                        "};"
+                        "set(2, 30);"
+                        "arr[0] = 10;"
+                        "arr;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    auto obj = (ArrayObject *) vm.topPointer();
+    ASSERT_EQ(*obj, std::vector<uint64_t>({10, 2, 30}));
+}
+
+TEST(VM, ArrayReductionKernels) {
+    const char *input = "define arr : int[] = [];"
+                        "for define i = 1; i <= 103; i++ {"
+                        "    define v = i * 37;"
+                        "    v = v % 101;"
+                        "    arr += v - 50;"
+                        "};"
+                        "define other : int[] = [];"
+                        "for define i = 0; i < 103; i++ { other += 2; };"
+                        "sum(arr) * 1000000 + min(arr) * 10000 + max(arr) * 100 + count_if_equal(arr, 0) + dot(arr, other);";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    int64_t sum = 0, min = INT64_MAX, max = INT64_MIN, zeros = 0;
+    for (int64_t i = 1; i <= 103; i++) {
+        auto value = (i * 37) % 101 - 50;
+        sum += value;
+        min = std::min(min, value);
+        max = std::max(max, value);
+        zeros += value == 0;
+    }
+    ASSERT_EQ((int64_t) vm.topStack(), sum * 1000000 + min * 10000 + max * 100 + zeros + sum * 2);
+}
+
+TEST(VM, ArrayUpdateKernels) {
+    const char *input = "define values : float[] = [];"
+                        "for define i = 0; i < 13; i++ { values += 1; };"
+                        "define ones : float[] = [];"
+                        "for define i = 0; i < 13; i++ { ones += 1; };"
+                        "fill(values, 1.5);"
+                        "scale(values, 2);"
+                        "add(values, ones);"
+                        "sum(values) + max(values) + count_if_equal(values, 4.0);";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(std::bit_cast<double>(vm.topStack()), 13 * 4.0 + 4.0 + 13);
+}
+
+TEST(VM, SortArrays) {
+    const char *input = "define arr : int[] = [];"
+                        "define weights : float[] = [];"
+                        "for define i = 1; i <= 1000; i++ {"
+                        "    define v = i * 7919;"
+                        "    v = v % 1009;"
+                        "    arr += v - 500;"
+                        "    weights += v - 500;"
+                        "};"
+                        "define part : int[] = arr[2:6];"
+                        "sort(part);"
+                        "sort(arr);"
+                        "sort_unstable(weights);";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    std::vector<int64_t> expected;
+    for (int64_t i = 1; i <= 1000; i++)
+        expected.push_back(i * 7919 % 1009 - 500);
+    std::sort(expected.begin(), expected.end());
+    auto arr = (ArrayObject *) vm.getGlobalPointer(program.find_global("arr"));
+    auto weights = (ArrayObject *) vm.getGlobalPointer(program.find_global("weights"));
+    for (size_t i = 0; i < expected.size(); i++) {
+        ASSERT_EQ((int64_t) arr->get(i), expected[i]);
+        ASSERT_EQ(std::bit_cast<double>(weights->get(i)), (double) expected[i]);
+    }
+}
+
+TEST(VM, ParallelSort) {
+    const char *input = "define arr : int[] = [];"
+                        "define other : int[] = [];"
+                        "for define i = 0; i < 5000; i++ {"
+                        "    define v = i * 48271;"
+                        "    v = v % 2147483647;"
+                        "    arr += v - 1000000000;"
+                        "    other += v % 7;"
+                        "};"
+                        "sort(arr);"
+                        "sort_unstable(other);";
+    VM vm;
+    vm.sortThreads = 3;
+    vm.sortParallelThreshold = 64;
+    auto program = compile(input);
+    vm.run(program);
+    std::vector<int64_t> expected, expectedOther;
+    for (int64_t i = 0; i < 5000; i++) {
+        expected.push_back(i * 48271 % 2147483647 - 1000000000);
+        expectedOther.push_back(i * 48271 % 2147483647 % 7);
+    }
+    std::sort(expected.begin(), expected.end());
+    std::sort(expectedOther.begin(), expectedOther.end());
+    auto arr = (ArrayObject *) vm.getGlobalPointer(program.find_global("arr"));
+    auto other = (ArrayObject *) vm.getGlobalPointer(program.find_global("other"));
+    for (size_t i = 0; i < expected.size(); i++) {
+        ASSERT_EQ((int64_t) arr->get(i), expected[i]);
+        ASSERT_EQ((int64_t) other->get(i), expectedOther[i]);
+    }
+}
+
+TEST(VM, MatrixElementAccess) {
+    const char *input = "define m : int[3, 4];"
+                        "for define i = 0; i < 3; i++ {"
+                        "    for define j = 0; j < 4; j++ { m[i, j] = i * 10 + j; };"
+                        "};"
+                        "define t : int[,] = transpose(m);"
+                        "fill(m, 1);"
+                        "scale(m, 3);"
+                        "add(m, m);"
+                        "t[3, 2] * 1000 + rows(t) * 100 + cols(t) * 10 + m[2, 3] + sum(m);";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 23 * 1000 + 4 * 100 + 3 * 10 + 6 + 12 * 6);
+}
+
+TEST(VM, MatrixMultiply) {
+    const char *input = "define n = 70;"
+                        "define a : float[n, n];"
+                        "define b : float[n, n];"
+                        "for define i = 0; i < n; i++ {"
+                        "    for define j = 0; j < n; j++ {"
+                        "        a[i, j] = i + j;"
+                        "        b[i, j] = i - j;"
+                        "    };"
+                        "};"
+                        "define c : float[,] = matmul(a, b);";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    auto c = (MatrixObject *) vm.getGlobalPointer(program.find_global("c"));
+    ASSERT_EQ(c->rows, 70);
+    ASSERT_EQ(c->cols, 70);
+    for (size_t i = 0; i < 70; i++) {
+        for (size_t j = 0; j < 70; j++) {
+            double expected = 0;
+            for (size_t k = 0; k < 70; k++)
+                expected += double(i + k) * (double(k) - double(j));
+            ASSERT_EQ(std::bit_cast<double>(c->at(i, j)), expected);
+        }
+    }
+}
+
+TEST(VM, TypedDeclarationsKeepSharedTypes) {
+    const char *input = "define f : function(x: int) -> int = { return x + 1; };"
+                        "define arr : int[] = [1, 2];"
+                        "define a : int = f(1);"
+                        "define b : int = f(arr[1]);"
+                        "define c : int = arr[0];"
+                        "a * 100 + b * 10 + c;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 231);
+}
+
+TEST(VM, MatrixShapeMismatch) {
+    const char *input = "define a : int[2, 3];"
+                        "define b : int[2, 3];"
+                        "matmul(a, b);";
+    VM vm;
+    auto program = compile(input);
+    ASSERT_THROW(vm.run(program), std::runtime_error);
+}
+
+TEST(VM, UserFunctionsShadowBuiltins) {
+    const char *input = "define sum : function(x: int) -> int = { return x + 1; };"
+                        "sum(41);";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 42);
+}
+
+TEST(VM, SlicesShareParentStorage) {
+    const char *input = "define arr : int[] = [1, 2, 3, 4, 5, 6];"
+                        "define view : int[] = arr[1:5];"
+                        "define inner : int[] = view[1:3];"
+                        "inner[0] = 30;"
+                        "arr += 7;"
+                        "view[3] + inner[1] + sum(arr[2:4]);";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 5 + 4 + 34);
+}
+
+TEST(VM, AppendingToSliceCopiesIt) {
+    const char *input = "define arr : int[] = [1, 2, 3, 4];"
+                        "define view : int[] = arr[0:2];"
+                        "view += 9;"
+                        "view[0] = 100;"
+                        "arr;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    auto arr = (ArrayObject *) vm.topPointer();
+    ASSERT_EQ(*arr, std::vector<uint64_t>({1, 2, 3, 4}));
+}
+
+TEST(VM, PackedSlicesAreViews) {
+    const char *input = "define flags : bool[] = [];"
+                        "for define i = 0; i < 100; i++ { flags += i % 2 == 0; };"
+                        "define window : bool[] = flags[65:70];"
+                        "window[0] = true;"
+                        "define bytes : i8[] = [1, 2, 3, 4, 5, 6, 7, 8, 9];"
+                        "define middle : i8[] = bytes[3:7];"
+                        "define inner : i8[] = middle[1:3];"
+                        "inner[1] = 0 - 6;"
+                        "define grown : bool[] = flags[63:67];"
+                        "grown += true;"
+                        "grown[1] = false;"
+                        "middle[0] + bytes[5] + len(grown);";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ((int64_t) vm.topStack(), 4 - 6 + 5);
+    auto flags = (ArrayObject *) vm.getGlobalPointer(program.find_global("flags"));
+    ASSERT_EQ(flags->get(65), 1);
+    ASSERT_EQ(flags->get(64), 1);
+    auto grown = (ArrayObject *) vm.getGlobalPointer(program.find_global("grown"));
+    ASSERT_EQ(grown->parent, nullptr);
+    ASSERT_EQ(*grown, std::vector<uint64_t>({0, 0, 1, 1, 1}));
+}
+
+TEST(VM, ArraySliceOutOfBounds) {
+    const char *input = "define arr : int[] = [1, 2, 3];"
+                        "arr[2:4];";
+    VM vm;
+    auto program = compile(input);
+    ASSERT_THROW(vm.run(program), std::runtime_error);
+}
+
+TEST(VM, SlicesKeepParentsAlive) {
+    const char *input = "define keep : int[] = [];"
+                        "define make : function(n: int) -> void = {"
+                        "    define arr : int[] = [];"
+                        "    for define i = 0; i < n; i++ { arr += i; };"
+                        "    keep = arr[n - 3:n];"
+                        "};"
+                        "make(1000);"
+                        "for define i = 0; i < 20000; i++ { define tmp : int[] = [i, i]; };"
+                        "keep;";
+    VM vm;
+    vm.gcPauseBudget = std::chrono::microseconds(1);
+    vm.gcStepInterval = 16;
+    vm.gcNurserySize = 4096;
+    vm.gcMinHeap = 16 * 1024;
+    auto program = compile(input);
+    vm.run(program);
+    auto keep = (ArrayObject *) vm.topPointer();
+    ASSERT_NE(keep->parent, nullptr);
+    ASSERT_EQ(*keep, std::vector<uint64_t>({997, 998, 999}));
+}
+
+TEST(VM, ObjectPayloadsAreStoredInline) {
+    const char *input = "define arr : int[] = [1, 2, 3];"
+                        "\"hello\";"
+                        "arr;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    auto array = (ArrayObject *) vm.popPointer();
+    ASSERT_EQ(array->data, array->inlineData());
+    ASSERT_EQ(*array, std::vector<uint64_t>({1, 2, 3}));
+    auto str = (StringObject *) vm.popPointer();
+    ASSERT_EQ((void *) str->chars, (void *) (str + 1));
+    ASSERT_TRUE(*str == "hello");
+}
+
+TEST(VM, AllocatorReusesFreedBlocks) {
+    Allocator allocator;
+    auto first = allocator.allocate(40);
+    allocator.deallocate(first, 40);
+    ASSERT_EQ(allocator.allocate(48), first);
+    auto remote = allocator.allocate(120);
+    std::thread([&] { allocator.deallocateConcurrent(remote, 120); }).join();
+    ASSERT_EQ(allocator.allocate(128), remote);
+    auto grown = allocator.reallocate(nullptr, 0, 24);
+    ASSERT_EQ(allocator.reallocate(grown, 24, 32), grown);
+    ASSERT_NE(allocator.reallocate(grown, 32, 64), grown);
+}
+
+TEST(VM, IncrementalCollectionKeepsReachableObjects) {
+    const char *input = "define check : function(n: int) -> int = {"
+                        "    define local : int[] = [n];"
+                        "    if n == 0 { return 0; };"
+                        "    for define i = 0; i < 3; i++ { define tmp : int[] = [i]; };"
+                        "    return check(n - 1) + local[0];"
+                        "};"
+                        "check(3000);";
+    VM vm;
+    vm.gcPauseBudget = std::chrono::microseconds(1);
+    vm.gcStepInterval = 16;
+    vm.gcNurserySize = 4096;
+    vm.gcMinHeap = 16 * 1024;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 4501500);
+}
+
+TEST(VM, ParallelMarkingKeepsReachableObjects) {
+    const char *input = "define check : function(n: int) -> int = {"
+                        "    define local : int[] = [n];"
+                        "    if n == 0 { return 0; };"
+                        "    for define i = 0; i < 3; i++ { define tmp : int[] = [i]; };"
+                        "    return check(n - 1) + local[0];"
+                        "};"
+                        "check(3000);";
+    VM vm;
+    vm.gcMarkThreads = 4;
+    vm.gcParallelMarkThreshold = 16;
+    vm.gcNurserySize = 4096;
+    vm.gcMinHeap = 16 * 1024;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 4501500);
+}
+
+TEST(VM, MajorCyclesOverlapBackgroundSweeping) {
+    // Every minor collection promotes the strings held by recent, which die
+    // in the tenured generation a few iterations later. With a small heap
+    // over a thousand major cycles run, each handing its dead strings to the
+    // sweeper, and later cycles start while it is still freeing them.
+    const char *input = "define stable : int[] = [];"
+                        "for define i = 0; i < 1000; i++ { stable += i; };"
+                        "define recent : str[] = [];"
+                        "for define i = 0; i < 256; i++ { recent += \"seed\"; };"
+                        "define name : str = \"item\";"
+                        "for define i = 0; i < 200000; i++ { recent[i % 256] = name + \"!\"; };"
+                        "sum(stable);";
+    VM vm;
+    vm.gcPauseBudget = std::chrono::microseconds(1);
+    vm.gcStepInterval = 16;
+    vm.gcNurserySize = 4096;
+    vm.gcMinHeap = 16 * 1024;
+    vm.gcGrowthFactor = 0.25;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 499500);
+    auto recent = (ArrayObject *) vm.getGlobalPointer(program.find_global("recent"));
+    for (size_t i = 0; i < recent->size; i++)
+        ASSERT_TRUE(*(StringObject *) recent->get(i) == "item!");
+    ASSERT_LT(vm.heapSize(), 128 * 1024);
+}
+
+TEST(VM, GarbageIsReclaimedByAllocatedBytes) {
+    const char *input = "define keep : int[] = [];"
+                        "for define i = 0; i < 1000; i++ { keep += i; };"
+                        "define tmp : int[] = [];"
+                        "for define i = 0; i < 100000; i++ { tmp = [i, i, i, i]; };"
+                        "keep[999];";
+    VM vm;
+    vm.gcNurserySize = 16 * 1024;
+    vm.gcMinHeap = 64 * 1024;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 999);
+    ASSERT_LT(vm.heapSize(), 128 * 1024);
+}
+
 TEST(VM, VoidReturnType) {
     const char *input = "define x = 0;"
                         "define foo : function() -> void = { x = 42; };"
@@ -353,3 +962,539 @@ TEST(VM, AddAFloatAndAnInteger) {
     vm.run(program);
     ASSERT_EQ(std::bit_cast<double>(vm.topStack()), 84.42);
 }
+
+TEST(VM, ImportOnlyCompilesReferencedExports) {
+    auto path = std::filesystem::temp_directory_path() / "spl_import_test.spl";
+    std::ofstream(path) << "export define unused = 1;"
+                           "export define helper : function(x: int) -> int = { return x * 2; };"
+                           "export define twice : function(x: int) -> int = { return helper(x); };"
+                           "export define other : function() -> int = { return 0; };";
+    auto input = "import \"" + path.string() + "\";"
+                 "twice(21);";
+    VM vm;
+    auto program = compile(input.c_str());
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 42);
+    ASSERT_EQ(program.find_global("unused"), -1);
+    ASSERT_EQ(program.segments.size(), 3);
+    std::filesystem::remove(path);
+}
+
+TEST(VM, StringLiteralsAreInterned) {
+    const char *input = "define a : str = \"hello\";"
+                        "define b : str = \"hello\";"
+                        "a;"
+                        "b;"
+                        "intern(a);";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    auto interned = (StringObject *) vm.popPointer();
+    auto b = (StringObject *) vm.popPointer();
+    auto a = (StringObject *) vm.popPointer();
+    ASSERT_EQ(a, b);
+    ASSERT_EQ(interned, a);
+    ASSERT_TRUE(a->interned);
+    ASSERT_EQ(a->hash, StringObject::hashOf("hello", 5));
+    ASSERT_EQ(program.strings.size(), 1);
+}
+
+TEST(VM, StringEquality) {
+    const std::vector<std::pair<const char *, uint64_t>> cases = {
+            {"define a : str = \"hello\"; a == \"hello\";", 1},
+            {"define a : str = \"hello\"; a != \"world\";", 1},
+            {"define a : str = \"hello\"; a == \"hell\";", 0},
+    };
+    for (auto &[input, expected]: cases) {
+        VM vm;
+        auto program = compile(input);
+        vm.run(program);
+        ASSERT_EQ(vm.topStack(), expected);
+    }
+}
+
+TEST(VM, StringConcatenation) {
+    const char *input = "define a : str = \"foo\";"
+                        "define b = a + \"bar\";"
+                        "b;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_TRUE(*(StringObject *) vm.topPointer() == "foobar");
+}
+
+TEST(VM, StringLengthAndIndex) {
+    const std::vector<std::pair<const char *, uint64_t>> cases = {
+            {"define a : str = \"hello\"; len(a + \"!\");", 6},
+            {"define a : str = \"hello\"; a[1];", 'e'},
+    };
+    for (auto &[input, expected]: cases) {
+        VM vm;
+        auto program = compile(input);
+        vm.run(program);
+        ASSERT_EQ(vm.topStack(), expected);
+    }
+}
+
+TEST(VM, StringBuilderGrowsGeometrically) {
+    const char *input = "define s : str = \"\";"
+                        "for define i = 0; i < 100; i++ {"
+                        "    s += \"ab\";"
+                        "};"
+                        "s;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    auto string = (StringObject *) vm.topPointer();
+    ASSERT_EQ(string->length, 200);
+    ASSERT_TRUE(string->builder);
+    ASSERT_LT(string->capacity, 512);
+    ASSERT_EQ(string->chars[199], 'b');
+}
+
+TEST(VM, SharedStringBuildersAreCopied) {
+    const char *input = "define s : str = \"a\";"
+                        "s += \"b\";"
+                        "define t = s;"
+                        "s += \"c\";"
+                        "t;"
+                        "s;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_TRUE(*(StringObject *) vm.popPointer() == "abc");
+    ASSERT_TRUE(*(StringObject *) vm.popPointer() == "ab");
+}
+
+TEST(VM, MapPutGetAndRemove) {
+    const char *input = "define m : map(int, int);"
+                        "for define i = 0; i < 1000; i++ {"
+                        "    m[i] = i * 2;"
+                        "};"
+                        "for define i = 0; i < 1000; i += 2 {"
+                        "    remove(m, i);"
+                        "};"
+                        "define hits = 0;"
+                        "for define i = 0; i < 1000; i++ {"
+                        "    if contains(m, i) {"
+                        "        hits += m[i];"
+                        "    };"
+                        "};"
+                        "hits + len(m);";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    // Odd keys 1..999 remain, their doubled values sum to 500000
+    ASSERT_EQ(vm.topStack(), 500000 + 500);
+}
+
+TEST(VM, MapWithStringKeys) {
+    const char *input = "define counts : map(str, int);"
+                        "define word : str = \"a\";"
+                        "for define i = 0; i < 5; i++ {"
+                        "    counts[word] = i;"
+                        "    word += \"a\";"
+                        "};"
+                        "counts[\"aaa\"];";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 2);
+}
+
+TEST(VM, MapValuesSurviveCollection) {
+    const char *input = "define names : map(int, str);"
+                        "reserve(names, 64);"
+                        "define name : str = \"item\";"
+                        "for define i = 0; i < 20000; i++ {"
+                        "    names[i % 64] = name + \"!\";"
+                        "};"
+                        "names[7];";
+    VM vm;
+    vm.gcNurserySize = 4096;
+    auto program = compile(input);
+    vm.run(program);
+    auto map = (MapObject *) vm.getGlobalPointer(program.find_global("names"));
+    ASSERT_EQ(map->capacity, 128);
+    ASSERT_TRUE(*(StringObject *) vm.topPointer() == "item!");
+}
+
+TEST(VM, StructFields) {
+    const char *input = "define Point : struct(x: int, label: str, y: float);"
+                        "define Segment : struct(from: Point, to: Point);"
+                        "define length : function(s: Segment) -> float = {"
+                        "    return s.to.y - s.from.y + s.to.x - s.from.x;"
+                        "};"
+                        "define p : Point = Point(1, \"a\", 2);"
+                        "define s = Segment(p, Point(4, \"b\", 8.5));"
+                        "p.x = 2;"
+                        "s.to.label = s.to.label + \"c\";"
+                        "length(s);";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(std::bit_cast<double>(vm.topStack()), 8.5);
+    auto segment = (StructObject *) vm.getGlobalPointer(program.find_global("s"));
+    auto to = (StructObject *) segment->fields()[1];
+    ASSERT_EQ(to->layout->pointerFields, 1);
+    ASSERT_TRUE(*(StringObject *) to->fields()[0] == "bc");
+    ASSERT_EQ(to->fields()[1], 4);
+}
+
+TEST(VM, StructFieldsSurviveCollection) {
+    const char *input = "define Entry : struct(id: int, name: str);"
+                        "define Pair : struct(first: Entry, second: Entry);"
+                        "define pair = Pair(Entry(0, \"zero\"), Entry(1, \"one\"));"
+                        "for define i = 0; i < 20000; i++ {"
+                        "    pair.second = Entry(i, pair.first.name + \"!\");"
+                        "};"
+                        "pair.second.name;";
+    VM vm;
+    vm.gcNurserySize = 4096;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_TRUE(*(StringObject *) vm.topPointer() == "zero!");
+}
+
+TEST(VM, RejectedStructCanBeRedeclared) {
+    VM vm;
+    Program program;
+    EXPECT_THROW(compile(program, "define Point : struct(x: int, x: int);"), std::runtime_error);
+    EXPECT_THROW(compile(program, "define Line : struct(from: Point, to: Point);"), std::runtime_error);
+    compile(program, "define Point : struct(x: int, y: int);"
+                     "define Line : struct(from: Point, to: Point);"
+                     "define line = Line(Point(1, 2), Point(3, 4));"
+                     "line.to.y - line.from.x;");
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 3);
+}
+
+TEST(VM, SoaColumns) {
+    const char *input = "define Particle : struct(id: int, name: str, mass: float, alive: bool);"
+                        "define ps : soa(Particle);"
+                        "for define i = 0; i < 100; i++ {"
+                        "    ps += Particle(i, \"p\", 0.5 * i, true);"
+                        "};"
+                        "ps += Particle(100, \"last\", 1.5, false);"
+                        "ps[3].mass = 10.0;"
+                        "ps[4].name = \"four\";"
+                        "define moved = ps[4];"
+                        "define masses = ps.mass;"
+                        "scale(masses, 2.0);"
+                        "define last : bool = ps[100].alive;"
+                        "len(ps) + ps[100].id + len(moved.name) + sum(ps.id) - 5050;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 205);
+    auto soa = (SoaObject *) vm.getGlobalPointer(program.find_global("ps"));
+    ASSERT_EQ(soa->size, 101);
+    for (size_t slot = 0; slot < soa->layout->fields.size(); slot++)
+        ASSERT_EQ(soa->columns()[slot]->size, 101);
+    ASSERT_FALSE(soa->columns()[soa->layout->find_field("alive")->slot]->get(100));
+    ASSERT_TRUE(soa->columns()[soa->layout->find_field("alive")->slot]->get(99));
+    auto mass = soa->columns()[soa->layout->find_field("mass")->slot];
+    ASSERT_EQ(mass->elementType, ArrayObject::ElementType::F64);
+    ASSERT_EQ(std::bit_cast<double>(mass->get(3)), 20.0);
+    double total = 0;
+    for (size_t i = 0; i < mass->size; i++)
+        total += std::bit_cast<double>(mass->get(i));
+    ASSERT_EQ(total, 2 * (2475.0 + 10.0));
+    auto moved = (StructObject *) vm.getGlobalPointer(program.find_global("moved"));
+    ASSERT_TRUE(*(StringObject *) moved->fields()[moved->layout->find_field("name")->slot] == "four");
+}
+
+TEST(VM, SoaRecordsSurviveCollection) {
+    const char *input = "define Entry : struct(id: int, name: str);"
+                        "define entries : soa(Entry);"
+                        "for define i = 0; i < 20000; i++ {"
+                        "    entries += Entry(i, \"e\" + \"!\");"
+                        "    define copy = Entry(i, \"copy\");"
+                        "    entries += copy;"
+                        "};"
+                        "entries[39999].name + entries[0].name;";
+    VM vm;
+    vm.gcNurserySize = 4096;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_TRUE(*(StringObject *) vm.topPointer() == "copye!");
+}
+
+TEST(VM, SoaIndexOutOfBounds) {
+    const char *input = "define Point : struct(x: int, y: int);"
+                        "define ps : soa(Point);"
+                        "ps += Point(1, 2);"
+                        "ps[1].x;";
+    VM vm;
+    auto program = compile(input);
+    EXPECT_THROW(vm.run(program), std::runtime_error);
+}
+
+TEST(VM, FixedWidthScalarsWrap) {
+    const std::vector<std::pair<const char *, int64_t>> cases = {
+            {"define a : u8 = 300; a;", 44},
+            {"define a : u8 = 200; a += 100; a;", 44},
+            {"define b : i8 = 200; b;", -56},
+            {"define c : i16 = 40000; c;", -25536},
+            {"define d : u32 = 0 - 1; d;", 4294967295},
+            {"define e : i32 = 2147483647; e++; e;", -2147483648},
+            {"define e : uint = 5; e = e - 6; e;", 4294967295},
+            {"(u8) 513;", 1},
+            {"(i8) 255 + 1;", 0},
+            {"define f : function(x: i8) -> int = { return x; }; f(130);", -126},
+            {"define g : function(x: int) -> u8 = { return x; }; g(257);", 1},
+            {"define P : struct(id: u8, w: int); define p = P(257, 3); p.id = p.id + 255; p.id;", 0},
+    };
+    for (auto &[input, expected]: cases) {
+        VM vm;
+        auto program = compile(input);
+        vm.run(program);
+        ASSERT_EQ((int64_t) vm.topStack(), expected) << input;
+    }
+}
+
+TEST(VM, Float32RoundsOnStore) {
+    const char *input = "define f : f32 = 0.1;"
+                        "f;";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(std::bit_cast<double>(vm.topStack()), (double) 0.1f);
+}
+
+TEST(VM, PackedArrays) {
+    const char *input = "define ids : u8[] = [1, 2, 255, 256];"
+                        "ids += 300;"
+                        "ids[0] = 0 - 1;"
+                        "define small : i16[] = [0 - 2, 70000];"
+                        "define weights : f32[] = [0.1, 2.5];"
+                        "weights += 1;"
+                        "define tail = ids[1:5];"
+                        "ids[0] + ids[3] + ids[4] + small[0] + small[1] + len(tail) + tail[3];";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 255 + 0 + 44 - 2 + 4464 + 4 + 44);
+    auto ids = (ArrayObject *) vm.getGlobalPointer(program.find_global("ids"));
+    ASSERT_EQ(ids->elementType, ArrayObject::ElementType::U8);
+    ASSERT_EQ(ArrayObject::storageBytes(ids->elementType, ids->capacity), 8);
+    auto weights = (ArrayObject *) vm.getGlobalPointer(program.find_global("weights"));
+    ASSERT_EQ(weights->elementType, ArrayObject::ElementType::F32);
+    ASSERT_EQ(std::bit_cast<double>(weights->get(0)), (double) 0.1f);
+    ASSERT_EQ(std::bit_cast<double>(weights->get(2)), 1.0);
+}
+
+TEST(VM, PackedArraysHaveNoKernels) {
+    EXPECT_THROW(compile("define ids : i32[] = [1, 2]; sum(ids);"), std::runtime_error);
+}
+
+TEST(VM, BitwiseOperators) {
+    const std::vector<std::pair<const char *, int64_t>> cases = {
+            {"12 & 10;", 8},
+            {"12 | 3;", 15},
+            {"12 ^ 10;", 6},
+            {"~5;", -6},
+            {"1 << 40;", 1099511627776},
+            {"define x = 0 - 16; x >> 2;", -4},
+            {"define n = 65; 1 << n;", 2},
+            {"define h = 1000000007; h >> 7 & 1023;", (1000000007 >> 7) & 1023},
+            {"define x = 3; x * 8 + x * 1 + x * 6;", 45},
+            {"define b : u8 = 0; b = ~b; b;", 255},
+            {"define m : function(x: int, y: int) -> int = { return x & y | x ^ y; }; m(5, 9);", 13},
+    };
+    for (auto &[input, expected]: cases) {
+        VM vm;
+        auto program = compile(input);
+        vm.run(program);
+        ASSERT_EQ((int64_t) vm.topStack(), expected) << input;
+    }
+    EXPECT_THROW(compile("1.5 & 1;"), std::runtime_error);
+}
+
+TEST(VM, SignedDivision) {
+    const std::vector<std::pair<const char *, int64_t>> cases = {
+            {"define x = 0 - 7; x / 2;", -3},
+            {"define x = 0 - 7; x % 2;", -1},
+            {"define x = 7; define y = 0 - 2; x / y;", -3},
+            {"define x = 7; define y = 0 - 2; x % y;", 1},
+            {"define x = 1 << 63; define y = 0 - 1; x / y;", INT64_MIN},
+            {"define x = 1 << 63; define y = 0 - 1; x % y;", 0},
+    };
+    for (auto &[input, expected]: cases) {
+        VM vm;
+        auto program = compile(input);
+        vm.run(program);
+        ASSERT_EQ((int64_t) vm.topStack(), expected) << input;
+    }
+}
+
+TEST(VM, ConstantShiftsAreStrengthReduced) {
+    auto program = compile("define x = 5; x * 16 + x << 3 >> 1;");
+    for (auto &instruction: program.segments[0].instructions) {
+        ASSERT_NE(instruction.type, Instruction::MulI64);
+        ASSERT_NE(instruction.type, Instruction::ShiftLeftI64);
+        ASSERT_NE(instruction.type, Instruction::ShiftRightI64);
+    }
+    VM vm;
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), (5 * 16 + 5) << 3 >> 1);
+}
+
+TEST(VM, CompressedArrays) {
+    const char *input = "define raw : int[] = [];"
+                        "define noisy : int[] = [];"
+                        "for define i = 0; i < 1000; i++ {"
+                        "    raw += 1000000 + 3 * i;"
+                        "    noisy += 500 - i * 7919 % 97;"
+                        "};"
+                        "define ids = compress(raw);"
+                        "define readings : compressed = compress(noisy);"
+                        "define back = decompress(readings);"
+                        "define first : function(c: compressed) -> int = { return c[0]; };"
+                        "ids[999] - first(ids) + readings[300] + len(ids) + sum(readings) - sum(back);";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 2997 + 500 - (300 * 7919) % 97 + 1000);
+    auto ids = (CompressedArrayObject *) vm.getGlobalPointer(program.find_global("ids"));
+    ASSERT_EQ(ids->blockCount, 4);
+    ASSERT_TRUE(ids->blocks()[0].delta);
+    ASSERT_EQ(ids->blocks()[0].width, 2);
+    auto readings = (CompressedArrayObject *) vm.getGlobalPointer(program.find_global("readings"));
+    ASSERT_FALSE(readings->blocks()[0].delta);
+    ASSERT_EQ(readings->blocks()[0].width, 7);
+    ASSERT_LT(CompressedArrayObject::blockSize(readings->blockCount, readings->words), 1000 * sizeof(uint64_t) / 2);
+    auto back = (ArrayObject *) vm.getGlobalPointer(program.find_global("back"));
+    auto noisy = (ArrayObject *) vm.getGlobalPointer(program.find_global("noisy"));
+    ASSERT_TRUE(*back == *noisy);
+}
+
+TEST(VM, CompressedArrayBlocks) {
+    std::vector<uint64_t> values;
+    // Constant, full width, sorted with negatives, and a partial block
+    values.insert(values.end(), 256, 7);
+    for (size_t i = 0; i < 256; i++)
+        values.push_back(i % 2 == 0 ? INT64_MIN + i : INT64_MAX - i);
+    for (int64_t i = 0; i < 256; i++)
+        values.push_back(i * i - 40000);
+    for (size_t i = 0; i < 37; i++)
+        values.push_back((i * 2654435761) % 1000);
+    auto plan = CompressedArrayObject::plan(values.data(), values.size());
+    auto compressed = makeObject<CompressedArrayObject>(
+            CompressedArrayObject::blockSize(plan.size(), CompressedArrayObject::totalWords(plan)),
+            values.data(), values.size(), plan);
+    ASSERT_EQ(compressed->blocks()[0].width, 0);
+    ASSERT_EQ(compressed->blocks()[1].width, 64);
+    ASSERT_TRUE(compressed->blocks()[2].delta);
+    ASSERT_EQ(compressed->blocks()[3].width, 10);
+    std::vector<uint64_t> decoded(values.size());
+    compressed->decode(decoded.data());
+    ASSERT_EQ(decoded, values);
+    for (size_t i = 0; i < values.size(); i++) {
+        auto index = values.size() - 1 - i;
+        ASSERT_EQ(compressed->get(index), values[index]) << index;
+    }
+    uint64_t total = 0;
+    for (auto value: values)
+        total += value;
+    ASSERT_EQ(compressed->sum(), total);
+    free(compressed);
+}
+
+TEST(VM, SmallCompressedArraysAreSmaller) {
+    const char *input = "define few : int[] = [];"
+                        "for define i = 0; i < 20; i++ { few += 4000000 + 5 * i; };"
+                        "define some : int[] = [];"
+                        "for define i = 0; i < 300; i++ { some += 4000000 + i * 7919 % 1000; };"
+                        "define a = compress(few);"
+                        "define b = compress(some);"
+                        "a[19] + b[299];";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 4000095 + 4000000 + 299 * 7919 % 1000);
+    for (auto [raw, packed]: {std::pair{"few", "a"}, std::pair{"some", "b"}}) {
+        auto array = (ArrayObject *) vm.getGlobalPointer(program.find_global(raw));
+        auto compressed = (CompressedArrayObject *) vm.getGlobalPointer(program.find_global(packed));
+        ASSERT_LT(CompressedArrayObject::blockSize(compressed->blockCount, compressed->words),
+                  ArrayObject::blockSize(ArrayObject::ElementType::I64, array->size))
+                << raw;
+    }
+}
+
+TEST(VM, CompressedIndexOutOfBounds) {
+    const char *input = "define c = compress([1, 2, 3]);"
+                        "c[3];";
+    VM vm;
+    auto program = compile(input);
+    EXPECT_THROW(vm.run(program), std::runtime_error);
+}
+
+TEST(VM, MissingMapKey) {
+    const char *input = "define m : map(int, float);"
+                        "m[1] = 2.5;"
+                        "m[2];";
+    VM vm;
+    auto program = compile(input);
+    EXPECT_THROW(vm.run(program), std::runtime_error);
+}
+
+TEST(VM, ReserveRejectsOverflowingMapCapacity) {
+    for (auto input : {"define m : map(int, int); reserve(m, 0 - 1);",
+                       "define m : map(int, int); reserve(m, 2305843009213693953);"}) {
+        VM vm;
+        auto program = compile(input);
+        EXPECT_THROW(vm.run(program), std::runtime_error) << input;
+    }
+}
+
+TEST(VM, StringSearchKernels) {
+    const std::vector<std::pair<const char *, uint64_t>> cases = {
+            {"define s : str = \"GET /index.html HTTP/1.1 200 GET /favicon.ico HTTP/1.1 404\"; find(s, \"HTTP\");", 16},
+            {"define s : str = \"GET /index.html HTTP/1.1 200 GET /favicon.ico HTTP/1.1 404\"; find(s, \"POST\");", -1},
+            {"define s : str = \"GET /index.html HTTP/1.1 200 GET /favicon.ico HTTP/1.1 404\"; count(s, \"GET\");", 2},
+            {"define s : str = \"GET /index.html HTTP/1.1 200 GET /favicon.ico HTTP/1.1 404\"; contains(s, \"404\");", 1},
+            {"define s : str = \"GET /index.html HTTP/1.1 200 GET /favicon.ico HTTP/1.1 404\"; starts_with(s, \"GET \");", 1},
+            {"define s : str = \"aaaa\"; count(s, \"aa\");", 2},
+            {"define s : str = \"................................................................needle.\"; find(s, \"needle\");", 64},
+    };
+    for (auto &[input, expected]: cases) {
+        VM vm;
+        auto program = compile(input);
+        vm.run(program);
+        ASSERT_EQ(vm.topStack(), expected) << input;
+    }
+}
+
+TEST(VM, SplitIntoViews) {
+    const char *input = "define line : str = \"alpha,beta,,gamma\";"
+                        "define fields : str[] = split(line, \",\");"
+                        "len(fields);";
+    VM vm;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_EQ(vm.topStack(), 4);
+    auto line = (StringObject *) vm.getGlobalPointer(program.find_global("line"));
+    auto fields = (ArrayObject *) vm.getGlobalPointer(program.find_global("fields"));
+    auto beta = (StringObject *) fields->get(1);
+    ASSERT_TRUE(*beta == "beta");
+    ASSERT_EQ(beta->chars, line->chars + 6);
+    ASSERT_EQ(((StringObject *) fields->get(2))->length, 0);
+    ASSERT_TRUE(*(StringObject *) fields->get(3) == "gamma");
+}
+
+TEST(VM, StringArraysSurviveCollection) {
+    const char *input = "define words : str[] = [];"
+                        "define word : str = \"w\";"
+                        "for define i = 0; i < 2000; i++ {"
+                        "    words += word + \"!\";"
+                        "    define parts = split(\"a b c\", \" \");"
+                        "    words[0] = parts[1];"
+                        "};"
+                        "words[0] + words[1999];";
+    VM vm;
+    vm.gcNurserySize = 4096;
+    auto program = compile(input);
+    vm.run(program);
+    ASSERT_TRUE(*(StringObject *) vm.topPointer() == "bw!");
+}